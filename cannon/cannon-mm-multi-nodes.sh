@@ -6,17 +6,27 @@ mkdir -p ${PWD}/{out,run,logs}
 # Src file name
 SRC_FILE="${PWD}/src/cannon-mm.cpp"
 
+# Extra program arguments passed through from the command line, e.g. "-e summa"
+ARGS="$*"
+
+# Log and run file name suffix for ARGS, e.g. "-e summa" yields "-e-summa"
+SUFFIX=$(echo "$ARGS" | sed -e "s|^ *||" -e "s| *$||" -e "s| \+|-|g")
+SUFFIX=${SUFFIX:+-${SUFFIX}}
+
+# NP numbers of processors, cannon needs perfect squares while summa runs on any
+NP_LIST=${NP_LIST:-"1 4 16 64"}
+
 # Compiled file name
 O_FILE="${PWD}/out/cannon-mm.o"
 
 # Compile SRC_FILE and output it to O_FILE
-mpic++ $SRC_FILE -o $O_FILE
+mpic++ -O3 $SRC_FILE -o $O_FILE
 
 # Loop through N matrix dimensions
 for N in 256 512 1024 2048 4096
 do
   # Loop through NP number of processors
-  for NP in 1 4 16 64
+  for NP in $NP_LIST
   do
     # Create padded N (4 digits) and NP (2 digits) for log and run file name
     # Example:
@@ -26,10 +36,10 @@ do
     printf -v PADDED_NP "%02d" $NP
 
     # Log file name
-    LOG_FILE="${PWD}/logs/cannon-mm-multi-nodes-n${PADDED_N}-np${PADDED_NP}.out"
+    LOG_FILE="${PWD}/logs/cannon-mm-multi-nodes-n${PADDED_N}-np${PADDED_NP}${SUFFIX}.out"
 
     # Run filename
-    RUN_FILE="${PWD}/run/cannon-mm-multi-nodes-n${PADDED_N}-np${PADDED_NP}.sh"
+    RUN_FILE="${PWD}/run/cannon-mm-multi-nodes-n${PADDED_N}-np${PADDED_NP}${SUFFIX}.sh"
 
     # Number of nodes required for corresponding NP
     N_NODES=$(((NP - 1) / 8 + 1))
@@ -99,6 +109,7 @@ do
     sed -i "s|__NUM_PROCESSORS__|${NP}|" $RUN_FILE
     sed -i "s|__O_FILE__|${O_FILE}|" $RUN_FILE
     sed -i "s|__MATRIX_N__|${N}|" $RUN_FILE
+    sed -i "s|__ARGS__|${ARGS}|" $RUN_FILE
 
     # Add execute permission to RUN_FILE
     chmod +x $RUN_FILE
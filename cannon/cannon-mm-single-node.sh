@@ -6,17 +6,27 @@ mkdir -p ${PWD}/{out,run,logs}
 # Src file name
 SRC_FILE="${PWD}/src/cannon-mm.cpp"
 
+# Extra program arguments passed through from the command line, e.g. "-e summa"
+ARGS="$*"
+
+# Log and run file name suffix for ARGS, e.g. "-e summa" yields "-e-summa"
+SUFFIX=$(echo "$ARGS" | sed -e "s|^ *||" -e "s| *$||" -e "s| \+|-|g")
+SUFFIX=${SUFFIX:+-${SUFFIX}}
+
+# NP numbers of processors, cannon needs perfect squares while summa runs on any
+NP_LIST=${NP_LIST:-"1 4 16 64"}
+
 # Compiled file name
 O_FILE="${PWD}/out/cannon-mm.o"
 
 # Compile SRC_FILE and output it to O_FILE
-mpic++ $SRC_FILE -o $O_FILE
+mpic++ -O3 $SRC_FILE -o $O_FILE
 
 # Loop through N matrix dimensions
 for N in 256 512 1024 2048 4096
 do
   # Loop through NP number of processors
-  for NP in 1 4 16 64
+  for NP in $NP_LIST
   do
     # Create padded N (4 digits) and NP (2 digits) for log and run file name
     # Example:
@@ -25,7 +35,7 @@ do
     printf -v PADDED_N "%04d" $N
     printf -v PADDED_NP "%02d" $NP
 
-    TASK="cannon-mm-single-node-n${PADDED_N}-np${PADDED_NP}"
+    TASK="cannon-mm-single-node-n${PADDED_N}-np${PADDED_NP}${SUFFIX}"
 
     # Log file name
     LOG_FILE="${PWD}/logs/${TASK}.out"
@@ -38,7 +48,7 @@ do
 
     # Run O_FILE the corresponding configurations
     echo "🏃 ${TASK}..."
-    mpirun --hostfile $HOST_FILE -np $NP $O_FILE $N > $LOG_FILE
+    mpirun --hostfile $HOST_FILE -np $NP $O_FILE $N $ARGS > $LOG_FILE
     echo "✅ ${TASK}"
   done
 done
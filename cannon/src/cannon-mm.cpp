@@ -4,183 +4,1707 @@
 // #include "stdafx.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
 #include <math.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include <sstream>
 #include "logger.h"
+#include "../../common/gemm.h"
+#include "strassen.h"
+#include "threadpool.h"
+#include "../../common/aligned-matrix.h"
+#include "../../common/matrix-file.h"
 
-int allocMatrix(int ***mat, int rows, int cols)
+// Number of row panels the local multiply is split into when shifts are
+// overlapped, the pending exchange is progressed (MPI_Testall) between panels
+#define OVERLAP_PANELS 16
+
+// MPI datatype, printable name and matrix file type of each element type the
+// engines are instantiated for (-T)
+template <typename T>
+struct MpiTraits;
+
+template <>
+struct MpiTraits<int>
+{
+  static MPI_Datatype type() { return MPI_INT; }
+  static const char *name() { return "int32"; }
+  static int fileType() { return MATRIX_FILE_INT32; }
+};
+
+template <>
+struct MpiTraits<long>
+{
+  static MPI_Datatype type() { return MPI_LONG; }
+  static const char *name() { return "int64"; }
+  static int fileType() { return MATRIX_FILE_INT64; }
+};
+
+template <>
+struct MpiTraits<float>
+{
+  static MPI_Datatype type() { return MPI_FLOAT; }
+  static const char *name() { return "float"; }
+  static int fileType() { return MATRIX_FILE_FLOAT32; }
+};
+
+template <>
+struct MpiTraits<double>
+{
+  static MPI_Datatype type() { return MPI_DOUBLE; }
+  static const char *name() { return "double"; }
+  static int fileType() { return MATRIX_FILE_FLOAT64; }
+};
+
+// Deterministic test matrices for -d, every rank generates its own blocks.
+// Both repeat along k with period GEN_PERIOD, which gives C in closed form.
+#define GEN_PERIOD 35
+
+int genA(int i, int k)
+{
+  return (3 * i + k) % 7 - 3;
+}
+
+int genB(int k, int j)
+{
+  return (k + 2 * j) % 5 - 2;
+}
+
+long expectedC(int i, int j, int N)
+{
+  long sum = 0;
+  for (int r = 0; r < GEN_PERIOD && r < N; r++)
+  {
+    long count = N / GEN_PERIOD + (r < N % GEN_PERIOD ? 1 : 0);
+    sum += count * genA(i, r) * genB(r, j);
+  }
+  return sum;
+}
+
+template <typename T>
+void generateBlock(T **block, int rowStart, int rows, int colStart, int cols, int (*gen)(int, int))
+{
+  for (int i = 0; i < rows; i++)
+  {
+    for (int j = 0; j < cols; j++)
+    {
+      block[i][j] = (T)gen(rowStart + i, colStart + j);
+    }
+  }
+}
+
+// Number of entries of the C block differing from the closed form
+template <typename T>
+long verifyBlock(T **block, int rowStart, int rows, int colStart, int cols, int N)
+{
+  long errors = 0;
+  for (int i = 0; i < rows; i++)
+  {
+    for (int j = 0; j < cols; j++)
+    {
+      if (block[i][j] != (T)expectedC(rowStart + i, colStart + j, N))
+      {
+        errors++;
+      }
+    }
+  }
+  return errors;
+}
+
+// Workers sharing the local block multiply of this rank (-t)
+ThreadPool *threadPool = NULL;
+
+// Strassen-Winograd recursion cutoff of the local multiply, 0 for the
+// blocked kernel only (-k, -x)
+int strassenCutoff = 0;
+
+// Allocation flags of every block and matrix (-H adds MATRIX_HUGE_PAGES)
+int matrixFlags = MATRIX_CONTIGUOUS;
+
+template <typename T>
+void blockMultiplyAdd(int m, int n, int k, const T *a, int lda, const T *b, int ldb, T *c, int ldc)
+{
+  if (strassenCutoff > 0)
+  {
+    strassenMultiplyAdd(m, n, k, a, lda, b, ldb, c, ldc, strassenCutoff);
+  }
+  else
+  {
+    matrixMultiplyAdd(m, n, k, a, lda, b, ldb, c, ldc);
+  }
+}
+
+// Row chunks of an m-row block handed to the thread pool, one per thread
+// and a multiple of the kernel's register tile
+void localChunks(int m, int *chunk, int *nChunks)
+{
+  int threads = threadPool ? threadPool->size() : 1;
+  *chunk = (m + threads - 1) / threads;
+  *chunk = (*chunk + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+  *nChunks = *chunk > 0 ? (m + *chunk - 1) / *chunk : 0;
+}
+
+// c = 0 for an m x n block, zeroed by the pool in the row chunks of
+// localMultiplyAdd so its pages are first touched by the worker threads
+// rather than all by the calling thread
+template <typename T>
+void zeroLocal(int m, int n, T *c, int ldc)
+{
+  int chunk, nChunks;
+  localChunks(m, &chunk, &nChunks);
+
+  if (nChunks <= 1)
+  {
+    for (int i = 0; i < m; i++)
+    {
+      memset(c + (size_t)i * ldc, 0, sizeof(T) * n);
+    }
+    return;
+  }
+
+  threadPool->parallelFor(nChunks, [&](int idx)
+                          {
+                            int r = idx * chunk;
+                            int rows = m - r < chunk ? m - r : chunk;
+                            for (int i = r; i < r + rows; i++)
+                            {
+                              memset(c + (size_t)i * ldc, 0, sizeof(T) * n);
+                            } });
+}
+
+// c += a * b with the rows of c split across the thread pool
+template <typename T>
+void localMultiplyAdd(int m, int n, int k, const T *a, int lda, const T *b, int ldb, T *c, int ldc)
+{
+  int chunk, nChunks;
+  localChunks(m, &chunk, &nChunks);
+
+  if (nChunks <= 1)
+  {
+    blockMultiplyAdd(m, n, k, a, lda, b, ldb, c, ldc);
+    return;
+  }
+
+  threadPool->parallelFor(nChunks, [&](int idx)
+                          {
+                            int r = idx * chunk;
+                            int rows = m - r < chunk ? m - r : chunk;
+                            blockMultiplyAdd(rows, n, k, a + (size_t)r * lda, lda, b, ldb, c + (size_t)r * ldc, ldc);
+                          });
+}
+
+template <typename T>
+void printMatrix(T **mat, int size)
+{
+  for (int i = 0; i < size; i++)
+  {
+    for (int j = 0; j < size; j++)
+    {
+      std::cout << mat[i][j] << " ";
+    }
+    std::cout << std::endl;
+  }
+}
+
+
+enum DataType
+{
+  DATA_INT32,
+  DATA_INT64,
+  DATA_FLOAT,
+  DATA_DOUBLE
+};
+
+enum Engine
+{
+  ENGINE_CANNON,
+  ENGINE_SUMMA,
+  ENGINE_25D
+};
+
+struct Options
+{
+  int N;
+  DataType dataType;
+  bool overlap;
+  bool persistent;
+  bool shared;
+  Engine engine;
+  int threads;
+  bool strassen;
+  int cutoff;
+  int layers;
+  bool distributed;
+  bool hugePages;
+  const char *inputA;
+  const char *inputB;
+  const char *outputC;
+  MatrixFileIo io;
+};
+
+// Every rank sets up its own blocks of A and B (-d or -A/-B), the root holds
+// no N x N matrix and nothing is scattered or gathered
+bool blocksOnRanks(const Options *opt)
+{
+  return opt->distributed || opt->inputA != NULL;
+}
+
+// Aggregated time per category, see the summary printed at the end of main
+struct Timing
+{
+  double compTime = 0.0;
+  double mpiBcastTime = 0.0;
+  double mpiTypeTime = 0.0;
+  double mpiScattervTime = 0.0;
+  double mpiCartTime = 0.0;
+  double mpiGathervTime = 0.0;
+  double mpiSendrecvReplaceTime = 0.0;
+  double mpiReduceTime = 0.0;
+  double hiddenTime = 0.0;
+  double verifyTime = 0.0;
+  double fileTime = 0.0;
+
+  // Work of the multiply phase: bytes this rank received through block
+  // shifts or panel broadcasts, and flops of its local multiplies
+  double shiftBytes = 0.0;
+  double flops = 0.0;
+};
+
+void usage(char *prog)
+{
+  fprintf(stderr, "Usage: %s <N> [-o] [-p] [-s] [-e cannon|summa|2.5d] [-c layers] [-t threads] [-T type] [-k gemm|strassen] [-x cutoff] [-d] [-H] [-A fileA -B fileB] [-C fileC] [-i auto|mpiio|mmap]\n", prog);
+  fprintf(stderr, "  -o  overlap block shifts with the local multiply (double-buffered)\n");
+  fprintf(stderr, "  -p  persistent shift requests (MPI_Send_init/MPI_Recv_init) restarted every step\n");
+  fprintf(stderr, "  -s  shift through a shared-memory window on each node, messages only across nodes\n");
+  fprintf(stderr, "  -e  multiplication engine (default: cannon), summa runs on any number of processes\n");
+  fprintf(stderr, "  -c  replication factor (layers) of the 2.5d engine (default: 1)\n");
+  fprintf(stderr, "  -t  threads sharing the local block multiply of each rank (default: 1)\n");
+  fprintf(stderr, "  -k  local multiply kernel (default: gemm), strassen recurses down to the cutoff\n");
+  fprintf(stderr, "  -x  smallest dimension the strassen kernel still splits (default: 512)\n");
+  fprintf(stderr, "  -T  element type: int, long, float or double (default: int)\n");
+  fprintf(stderr, "  -d  generate and verify blocks on every rank, no N x N matrices on the root\n");
+  fprintf(stderr, "  -H  back matrices and blocks of 2 MiB or more with transparent huge pages\n");
+  fprintf(stderr, "  -A  read A from a matrix file, every rank reads its own blocks (needs -B)\n");
+  fprintf(stderr, "  -B  read B from a matrix file\n");
+  fprintf(stderr, "  -C  write C to a matrix file, every rank writes its own blocks\n");
+  fprintf(stderr, "  -i  matrix file access (default: auto), mmap on a single node, MPI-IO otherwise\n");
+}
+
+void parseArgs(int argc, char *argv[], Options *opt)
+{
+  char *cp;
+  long LN;
+  int c;
+
+  opt->dataType = DATA_INT32;
+  opt->overlap = false;
+  opt->persistent = false;
+  opt->shared = false;
+  opt->engine = ENGINE_CANNON;
+  opt->threads = 1;
+  opt->strassen = false;
+  opt->cutoff = 512;
+  opt->layers = 1;
+  opt->distributed = false;
+  opt->hugePages = false;
+  opt->inputA = NULL;
+  opt->inputB = NULL;
+  opt->outputC = NULL;
+  opt->io = MATRIX_IO_AUTO;
+
+  while ((c = getopt(argc, argv, "opse:t:c:dT:k:x:HA:B:C:i:")) != -1)
+  {
+    switch (c)
+    {
+    case 'o':
+      opt->overlap = true;
+      break;
+    case 'p':
+      opt->persistent = true;
+      break;
+    case 's':
+      opt->shared = true;
+      break;
+    case 'e':
+      if (strcmp(optarg, "cannon") == 0)
+      {
+        opt->engine = ENGINE_CANNON;
+      }
+      else if (strcmp(optarg, "summa") == 0)
+      {
+        opt->engine = ENGINE_SUMMA;
+      }
+      else if (strcmp(optarg, "2.5d") == 0)
+      {
+        opt->engine = ENGINE_25D;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown engine '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'd':
+      opt->distributed = true;
+      break;
+    case 'H':
+      opt->hugePages = true;
+      break;
+    case 'A':
+      opt->inputA = optarg;
+      break;
+    case 'B':
+      opt->inputB = optarg;
+      break;
+    case 'C':
+      opt->outputC = optarg;
+      break;
+    case 'i':
+      if (strcmp(optarg, "auto") == 0)
+      {
+        opt->io = MATRIX_IO_AUTO;
+      }
+      else if (strcmp(optarg, "mpiio") == 0)
+      {
+        opt->io = MATRIX_IO_MPIIO;
+      }
+      else if (strcmp(optarg, "mmap") == 0)
+      {
+        opt->io = MATRIX_IO_MMAP;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown matrix file access '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'T':
+      if (strcmp(optarg, "int") == 0 || strcmp(optarg, "int32") == 0)
+      {
+        opt->dataType = DATA_INT32;
+      }
+      else if (strcmp(optarg, "long") == 0 || strcmp(optarg, "int64") == 0)
+      {
+        opt->dataType = DATA_INT64;
+      }
+      else if (strcmp(optarg, "float") == 0)
+      {
+        opt->dataType = DATA_FLOAT;
+      }
+      else if (strcmp(optarg, "double") == 0)
+      {
+        opt->dataType = DATA_DOUBLE;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown element type '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'k':
+      if (strcmp(optarg, "gemm") == 0)
+      {
+        opt->strassen = false;
+      }
+      else if (strcmp(optarg, "strassen") == 0)
+      {
+        opt->strassen = true;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown kernel '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'x':
+      opt->cutoff = atoi(optarg);
+      if (opt->cutoff < 2)
+      {
+        fprintf(stderr, "[ERROR] Strassen cutoff must be at least 2, found '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'c':
+      opt->layers = atoi(optarg);
+      if (opt->layers < 1)
+      {
+        fprintf(stderr, "[ERROR] Number of layers must be positive, found '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    case 't':
+      opt->threads = atoi(optarg);
+      if (opt->threads < 1)
+      {
+        fprintf(stderr, "[ERROR] Number of threads must be positive, found '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if ((opt->inputA == NULL) != (opt->inputB == NULL))
+  {
+    fprintf(stderr, "[ERROR] Input files are given for both A and B (-A, -B) or for none\n");
+    exit(1);
+  }
+  if (opt->inputA && opt->distributed)
+  {
+    fprintf(stderr, "[ERROR] Input files (-A, -B) and generated blocks (-d) cannot be combined\n");
+    exit(1);
+  }
+  if (opt->layers > 1 && opt->engine != ENGINE_25D)
+  {
+    fprintf(stderr, "[ERROR] Replication (-c %d) is only used by the 2.5d engine (-e 2.5d)\n", opt->layers);
+    exit(1);
+  }
+
+  // Check for the right number of arguments
+  if (argc - optind != 1)
+  {
+    fprintf(stderr, "[ERROR] Must be run with exactly 1 argument, found %d!\n", argc - optind);
+    usage(argv[0]);
+    exit(1);
+  }
+
+  cp = argv[optind];
+  if (*cp == 0)
+  {
+    fprintf(stderr, "[ERROR] Argument is an empty string\n");
+    exit(1);
+  }
+
+  LN = strtol(cp, &cp, 10);
+  if (*cp != 0)
+  {
+    fprintf(stderr, "[ERROR] Argument '%s' is not an integer -- '%s'\n", argv[optind], cp);
+    exit(1);
+  }
+
+  opt->N = (int)LN;
+}
+
+// Read this rank's block of the N x N matrix in path (-A, -B), collective
+// over comm
+template <typename T>
+void readBlock(const Options *opt, const char *path, MPI_Comm comm, T **block, int rowStart, int rows, int colStart,
+               int cols)
+{
+  MatrixFile f;
+  int rank;
+
+  MPI_Comm_rank(comm, &rank);
+
+  int status = matrixFileOpen(&f, path, comm, opt->io);
+  if (status != MATRIX_FILE_OK)
+  {
+    if (rank == 0)
+    {
+      printf("[ERROR] Matrix file %s: %s!\n", path, matrixFileError(status));
+      fflush(stdout);
+    }
+    MPI_Abort(MPI_COMM_WORLD, 9);
+  }
+  if (f.header.type != MpiTraits<T>::fileType() || f.header.rows != opt->N || f.header.cols != opt->N)
+  {
+    if (rank == 0)
+    {
+      printf("[ERROR] Matrix file %s holds a %lld x %lld %s matrix, expected %d x %d %s!\n", path,
+             (long long)f.header.rows, (long long)f.header.cols, matrixFileTypeName(f.header.type),
+             opt->N, opt->N, MpiTraits<T>::name());
+      fflush(stdout);
+    }
+    MPI_Abort(MPI_COMM_WORLD, 9);
+  }
+
+  if (matrixFileReadBlock(&f, rowStart, rows, colStart, cols, &(block[0][0]), cols, MpiTraits<T>::type()) != MATRIX_FILE_OK)
+  {
+    printf("[ERROR] Reading block of %s in rank %d failed!\n", path, rank);
+    MPI_Abort(MPI_COMM_WORLD, 9);
+  }
+  matrixFileClose(&f);
+}
+
+// Write this rank's block of C to the output file (-C), collective over comm.
+// Ranks holding no part of C take part with rows = 0
+template <typename T>
+void writeBlock(const Options *opt, MPI_Comm comm, T **block, int rowStart, int rows, int colStart, int cols)
+{
+  MatrixFile f;
+  int rank;
+
+  MPI_Comm_rank(comm, &rank);
+
+  int status = matrixFileCreate(&f, opt->outputC, comm, MpiTraits<T>::fileType(), opt->N, opt->N, opt->io);
+  if (status == MATRIX_FILE_OK)
+  {
+    status = matrixFileWriteBlock(&f, rowStart, rows, colStart, cols, &(block[0][0]), cols, MpiTraits<T>::type());
+  }
+  if (status != MATRIX_FILE_OK)
+  {
+    printf("[ERROR] Matrix file %s in rank %d: %s!\n", opt->outputC, rank, matrixFileError(status));
+    MPI_Abort(MPI_COMM_WORLD, 9);
+  }
+  matrixFileClose(&f);
+}
+
+// This rank's blocks of A and B when no root distributes them: generated from
+// their global indices (-d) or read from the input files (-A, -B)
+template <typename T>
+void loadBlocks(const Options *opt, MPI_Comm comm, T **localA, T **localB, int rowStart, int rows, int colStart,
+                int cols, Logger *logger, Timing *t)
+{
+  if (opt->distributed)
+  {
+    generateBlock(localA, rowStart, rows, colStart, cols, genA);
+    generateBlock(localB, rowStart, rows, colStart, cols, genB);
+    logger->log(&t->compTime, "COMP");
+    return;
+  }
+
+  readBlock(opt, opt->inputA, comm, localA, rowStart, rows, colStart, cols);
+  readBlock(opt, opt->inputB, comm, localB, rowStart, rows, colStart, cols);
+  logger->log(&t->fileTime, "FILE");
+}
+
+// Balanced split of n items into parts, sizes differ by at most one
+void blockRange(int n, int parts, int idx, int *start, int *count)
+{
+  int q = n / parts;
+  int r = n % parts;
+
+  *count = q + (idx < r ? 1 : 0);
+  *start = idx * q + (idx < r ? idx : r);
+}
+
+// Index of the part of blockRange(n, parts, ...) holding item k
+int blockOwner(int n, int parts, int k)
+{
+  int q = n / parts;
+  int r = n % parts;
+
+  if (k < r * (q + 1))
+  {
+    return k / (q + 1);
+  }
+  return r + (k - r * (q + 1)) / q;
+}
+
+// c += a * b in row panels, progressing the pending requests in between.
+// Returns how long the requests stayed in flight during the multiply, i.e.
+// the communication time hidden behind compute
+template <typename T>
+double multiplyOverlapped(int m, int n, int k, const T *a, int lda, const T *b, int ldb, T *c, int ldc,
+                          int nReqs, MPI_Request *reqs)
+{
+  // Panels are whole register tiles of the local kernel
+  int panelRows = (m + OVERLAP_PANELS - 1) / OVERLAP_PANELS;
+  panelRows = (panelRows + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+
+  double postTime = MPI_Wtime();
+  double doneTime = 0.0;
+  int done = nReqs == 0;
+
+  for (int r = 0; r < m; r += panelRows)
+  {
+    int panel = m - r < panelRows ? m - r : panelRows;
+    localMultiplyAdd(panel, n, k, a + (size_t)r * lda, lda, b, ldb, c + (size_t)r * ldc, ldc);
+
+    if (!done)
+    {
+      MPI_Testall(nReqs, reqs, &done, MPI_STATUSES_IGNORE);
+      if (done)
+      {
+        doneTime = MPI_Wtime();
+      }
+    }
+  }
+
+  if (nReqs == 0)
+  {
+    return 0.0;
+  }
+  return (done ? doneTime : MPI_Wtime()) - postTime;
+}
+
+// Cannon steps over an MPI_Win_allocate_shared window per node. Every rank
+// publishes its skewed blocks once, and at step k reads the A block of the
+// rank k columns to the right and the B block of the rank k rows below. On
+// the same node that is a pointer into the window; only blocks owned on
+// another node are sent, the next step's ones while the current multiply runs
+template <typename T>
+void cannonStepsShared(const Options *opt, int steps, int blockDim, T **localA, T **localB, T **localC,
+                       MPI_Comm cartComm, Logger *logger, Timing *t)
+{
+  MPI_Comm nodeComm;
+  MPI_Group cartGroup, nodeGroup;
+  MPI_Win win;
+  MPI_Datatype elemType = MpiTraits<T>::type();
+  T **recvA[2] = {NULL, NULL}, **recvB[2] = {NULL, NULL};
+  T *window;
+  int count = blockDim * blockDim;
+  int rank, size, nodeSize;
+
+  MPI_Comm_rank(cartComm, &rank);
+  MPI_Comm_size(cartComm, &size);
+
+  for (int b = 0; b < 2; b++)
+  {
+    if (allocMatrix(&recvA[b], blockDim, blockDim, matrixFlags) != 0 || allocMatrix(&recvB[b], blockDim, blockDim, matrixFlags) != 0)
+    {
+      printf("[ERROR] Matrix alloc for recvA/recvB in rank %d failed!\n", rank);
+      MPI_Abort(MPI_COMM_WORLD, 8);
+    }
+  }
+
+  int *nodeRank = (int *)malloc(sizeof(int) * size);
+  int *cartRanks = (int *)malloc(sizeof(int) * size);
+  T **base = (T **)malloc(sizeof(T *) * size);
+  logger->log(&t->compTime, "COMP");
+
+  MPI_Comm_split_type(cartComm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+  MPI_Comm_size(nodeComm, &nodeSize);
+  MPI_Win_allocate_shared(2 * sizeof(T) * count, sizeof(T), MPI_INFO_NULL, nodeComm, &window, &win);
+
+  // Node rank of every grid rank (MPI_UNDEFINED off node) and the base of
+  // its blocks in the window
+  for (int r = 0; r < size; r++)
+  {
+    cartRanks[r] = r;
+  }
+  MPI_Comm_group(cartComm, &cartGroup);
+  MPI_Comm_group(nodeComm, &nodeGroup);
+  MPI_Group_translate_ranks(cartGroup, size, cartRanks, nodeGroup, nodeRank);
+  MPI_Group_free(&cartGroup);
+  MPI_Group_free(&nodeGroup);
+
+  for (int r = 0; r < size; r++)
+  {
+    base[r] = NULL;
+    if (nodeRank[r] != MPI_UNDEFINED)
+    {
+      MPI_Aint winSize;
+      int dispUnit;
+      MPI_Win_shared_query(win, nodeRank[r], &winSize, &dispUnit, &base[r]);
+    }
+  }
+
+  memcpy(window, &(localA[0][0]), sizeof(T) * count);
+  memcpy(window + count, &(localB[0][0]), sizeof(T) * count);
+
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+  MPI_Win_sync(win);
+  MPI_Barrier(nodeComm);
+  MPI_Win_sync(win);
+  logger->log(&t->mpiSendrecvReplaceTime, "MPI_Win_");
+
+  // Sources of the blocks needed at step k, posting receives (and the sends
+  // of this rank's own blocks) for the ones crossing a node boundary
+  auto post = [&](int k, int b, const T **a, const T **bb, MPI_Request *reqs) -> int
+  {
+    int nReqs = 0;
+    int readerA, ownerA, readerB, ownerB;
+    MPI_Cart_shift(cartComm, 1, k, &readerA, &ownerA);
+    MPI_Cart_shift(cartComm, 0, k, &readerB, &ownerB);
+
+    if (nodeRank[ownerA] != MPI_UNDEFINED)
+    {
+      *a = base[ownerA];
+    }
+    else
+    {
+      MPI_Irecv(&(recvA[b][0][0]), count, elemType, ownerA, 1, cartComm, &reqs[nReqs++]);
+      *a = &(recvA[b][0][0]);
+    }
+    if (nodeRank[ownerB] != MPI_UNDEFINED)
+    {
+      *bb = base[ownerB] + count;
+    }
+    else
+    {
+      MPI_Irecv(&(recvB[b][0][0]), count, elemType, ownerB, 2, cartComm, &reqs[nReqs++]);
+      *bb = &(recvB[b][0][0]);
+    }
+    if (nodeRank[readerA] == MPI_UNDEFINED)
+    {
+      MPI_Isend(window, count, elemType, readerA, 1, cartComm, &reqs[nReqs++]);
+    }
+    if (nodeRank[readerB] == MPI_UNDEFINED)
+    {
+      MPI_Isend(window + count, count, elemType, readerB, 2, cartComm, &reqs[nReqs++]);
+    }
+    return nReqs;
+  };
+
+  const T *curA = window, *curB = window + count;
+  logger->log(&t->mpiCartTime, "MPI_Cart_shift");
+
+  for (int k = 0; k < steps; k++)
+  {
+    MPI_Request reqs[4];
+    const T *nextA = NULL, *nextB = NULL;
+    int nReqs = 0;
+    if (k < steps - 1)
+    {
+      nReqs = post(k + 1, (k + 1) % 2, &nextA, &nextB, reqs);
+    }
+    logger->log(&t->mpiSendrecvReplaceTime, "MPI_Isend/Irecv");
+
+    if (opt->overlap)
+    {
+      double hidden = multiplyOverlapped(blockDim, blockDim, blockDim, curA, blockDim, curB, blockDim,
+                                         &(localC[0][0]), blockDim, nReqs, reqs);
+      t->flops += 2.0 * blockDim * blockDim * blockDim;
+      logger->log(&t->compTime, "COMP");
+
+      if (nReqs > 0)
+      {
+        logger->record(&t->hiddenTime, hidden, "HIDDEN");
+      }
+    }
+    else
+    {
+      localMultiplyAdd(blockDim, blockDim, blockDim, curA, blockDim, curB, blockDim, &(localC[0][0]), blockDim);
+      t->flops += 2.0 * blockDim * blockDim * blockDim;
+      logger->log(&t->compTime, "COMP");
+    }
+
+    MPI_Waitall(nReqs, reqs, MPI_STATUSES_IGNORE);
+    t->shiftBytes += (double)((nextA == &(recvA[(k + 1) % 2][0][0])) + (nextB == &(recvB[(k + 1) % 2][0][0]))) * count * sizeof(T);
+    logger->log(&t->mpiSendrecvReplaceTime, "MPI_Waitall");
+
+    curA = nextA;
+    curB = nextB;
+  }
+
+  // Nobody may still read a block when the window goes away
+  MPI_Barrier(nodeComm);
+  MPI_Win_unlock_all(win);
+  MPI_Win_free(&win);
+  MPI_Comm_free(&nodeComm);
+  logger->log(&t->mpiSendrecvReplaceTime, "MPI_Win_free");
+
+  for (int b = 0; b < 2; b++)
+  {
+    freeMatrix(&recvA[b]);
+    freeMatrix(&recvB[b]);
+  }
+  free(nodeRank);
+  free(cartRanks);
+  free(base);
+}
+
+// The multiply-and-shift steps of Cannon's algorithm on the (skewed) blocks:
+// A moves left along dimension 1 of cartComm, B moves up along dimension 0
+template <typename T>
+void cannonSteps(const Options *opt, int steps, int blockDim, T ***localA, T ***localB, T **localC,
+                 MPI_Comm cartComm, Logger *logger, Timing *t)
+{
+  T **localARec = NULL, **localBRec = NULL;
+  MPI_Datatype elemType = MpiTraits<T>::type();
+  int count = blockDim * blockDim;
+  int left, right, up, down;
+  int rank;
+
+  if (opt->shared)
+  {
+    cannonStepsShared(opt, steps, blockDim, *localA, *localB, localC, cartComm, logger, t);
+    return;
+  }
+
+  MPI_Comm_rank(cartComm, &rank);
+
+  if (opt->overlap || opt->persistent)
+  {
+    if (allocMatrix(&localARec, blockDim, blockDim, matrixFlags) != 0 || allocMatrix(&localBRec, blockDim, blockDim, matrixFlags) != 0)
+    {
+      printf("[ERROR] Matrix alloc for localARec/localBRec in rank %d failed!\n", rank);
+      MPI_Abort(MPI_COMM_WORLD, 8);
+    }
+  }
+  logger->log(&t->compTime, "COMP");
+
+  // Neighbours of the unit shift do not change between steps
+  MPI_Cart_shift(cartComm, 1, 1, &left, &right);
+  MPI_Cart_shift(cartComm, 0, 1, &up, &down);
+  logger->log(&t->mpiCartTime, "MPI_Cart_shift");
+
+  if (opt->persistent)
+  {
+    // Requests of parity p send buffer set p and receive into set 1 - p, so
+    // the same eight requests are restarted for the whole loop
+    T **bufA[2] = {*localA, localARec};
+    T **bufB[2] = {*localB, localBRec};
+    MPI_Request reqs[2][4];
+    int cur = 0;
+
+    for (int p = 0; p < 2; p++)
+    {
+      MPI_Recv_init(&(bufA[1 - p][0][0]), count, elemType, right, 1, cartComm, &reqs[p][0]);
+      MPI_Recv_init(&(bufB[1 - p][0][0]), count, elemType, down, 2, cartComm, &reqs[p][1]);
+      MPI_Send_init(&(bufA[p][0][0]), count, elemType, left, 1, cartComm, &reqs[p][2]);
+      MPI_Send_init(&(bufB[p][0][0]), count, elemType, up, 2, cartComm, &reqs[p][3]);
+    }
+    logger->log(&t->mpiSendrecvReplaceTime, "MPI_Send/Recv_init");
+
+    for (int k = 0; k < steps; k++)
+    {
+      int nReqs = k < steps - 1 ? 4 : 0;
+
+      if (opt->overlap)
+      {
+        MPI_Startall(nReqs, reqs[cur]);
+        logger->log(&t->mpiSendrecvReplaceTime, "MPI_Startall");
+
+        double hidden = multiplyOverlapped(blockDim, blockDim, blockDim, &(bufA[cur][0][0]), blockDim, &(bufB[cur][0][0]), blockDim,
+                                           &(localC[0][0]), blockDim, nReqs, reqs[cur]);
+        t->flops += 2.0 * blockDim * blockDim * blockDim;
+        logger->log(&t->compTime, "COMP");
+
+        if (nReqs > 0)
+        {
+          logger->record(&t->hiddenTime, hidden, "HIDDEN");
+        }
+      }
+      else
+      {
+        localMultiplyAdd(blockDim, blockDim, blockDim, &(bufA[cur][0][0]), blockDim, &(bufB[cur][0][0]), blockDim, &(localC[0][0]), blockDim);
+        t->flops += 2.0 * blockDim * blockDim * blockDim;
+        logger->log(&t->compTime, "COMP");
+
+        MPI_Startall(nReqs, reqs[cur]);
+      }
+
+      MPI_Waitall(nReqs, reqs[cur], MPI_STATUSES_IGNORE);
+      if (nReqs > 0)
+      {
+        t->shiftBytes += 2.0 * count * sizeof(T);
+        cur = 1 - cur;
+      }
+      logger->log(&t->mpiSendrecvReplaceTime, "MPI_Waitall");
+    }
+
+    for (int p = 0; p < 2; p++)
+    {
+      for (int r = 0; r < 4; r++)
+      {
+        MPI_Request_free(&reqs[p][r]);
+      }
+    }
+
+    *localA = bufA[cur];
+    localARec = bufA[1 - cur];
+    *localB = bufB[cur];
+    localBRec = bufB[1 - cur];
+  }
+  else if (opt->overlap)
+  {
+    for (int k = 0; k < steps; k++)
+    {
+      // Post the next shift into the spare buffers, the last step needs none
+      MPI_Request reqs[4];
+      int nReqs = 0;
+      if (k < steps - 1)
+      {
+        MPI_Irecv(&(localARec[0][0]), count, elemType, right, 1, cartComm, &reqs[nReqs++]);
+        MPI_Irecv(&(localBRec[0][0]), count, elemType, down, 2, cartComm, &reqs[nReqs++]);
+        MPI_Isend(&((*localA)[0][0]), count, elemType, left, 1, cartComm, &reqs[nReqs++]);
+        MPI_Isend(&((*localB)[0][0]), count, elemType, up, 2, cartComm, &reqs[nReqs++]);
+      }
+      logger->log(&t->mpiSendrecvReplaceTime, "MPI_Isend/Irecv");
+
+      // Multiply the current blocks while the shift is in flight
+      double hidden = multiplyOverlapped(blockDim, blockDim, blockDim, &((*localA)[0][0]), blockDim, &((*localB)[0][0]), blockDim,
+                                         &(localC[0][0]), blockDim, nReqs, reqs);
+      logger->log(&t->compTime, "COMP");
+
+      t->flops += 2.0 * blockDim * blockDim * blockDim;
+
+      if (nReqs > 0)
+      {
+        logger->record(&t->hiddenTime, hidden, "HIDDEN");
+      }
+
+      MPI_Waitall(nReqs, reqs, MPI_STATUSES_IGNORE);
+      t->shiftBytes += (double)nReqs / 2 * count * sizeof(T);
+      logger->log(&t->mpiSendrecvReplaceTime, "MPI_Waitall");
+
+      // Swap in the received blocks
+      T **tmp = *localA;
+      *localA = localARec;
+      localARec = tmp;
+      tmp = *localB;
+      *localB = localBRec;
+      localBRec = tmp;
+    }
+  }
+  else
+  {
+    for (int k = 0; k < steps; k++)
+    {
+      localMultiplyAdd(blockDim, blockDim, blockDim, &((*localA)[0][0]), blockDim, &((*localB)[0][0]), blockDim, &(localC[0][0]), blockDim);
+      t->flops += 2.0 * blockDim * blockDim * blockDim;
+      logger->log(&t->compTime, "COMP");
+
+      // The blocks are not needed after the last step
+      if (k == steps - 1)
+      {
+        break;
+      }
+
+      // Shift A once (left) and B once (up)
+      MPI_Sendrecv_replace(&((*localA)[0][0]), count, elemType, left, 1, right, 1, cartComm, MPI_STATUS_IGNORE);
+      MPI_Sendrecv_replace(&((*localB)[0][0]), count, elemType, up, 1, down, 1, cartComm, MPI_STATUS_IGNORE);
+      t->shiftBytes += 2.0 * count * sizeof(T);
+      logger->log(&t->mpiSendrecvReplaceTime, "MPI_Sendrecv_replace");
+    }
+  }
+
+  if (opt->overlap || opt->persistent)
+  {
+    freeMatrix(&localARec);
+    freeMatrix(&localBRec);
+  }
+}
+
+template <typename T>
+void cannonMultiply(const Options *opt, T **A, T **B, T **C, long *errors, Logger *logger, Timing *t)
+{
+  MPI_Comm cartComm;
+  int dim[2], period[2], reorder;
+  int coord[2];
+  T **localA = NULL, **localB = NULL, **localC = NULL;
+  MPI_Datatype elemType = MpiTraits<T>::type();
+  int rows = opt->N;
+  int columns = opt->N;
+  int worldSize;
+  int procDim;
+  int blockDim;
+  int left, right, up, down;
+  int bCastData[4];
+  int rank;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &worldSize);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  if (rank == 0)
+  {
+    procDim = (int)sqrt(worldSize);
+    blockDim = columns / procDim;
+
+    bCastData[0] = procDim;
+    bCastData[1] = blockDim;
+    bCastData[2] = rows;
+    bCastData[3] = columns;
+  }
+  logger->log(&t->compTime, "COMP");
+
+  // Create 2D Cartesian grid of processes
+  MPI_Bcast(&bCastData, 4, MPI_INT, 0, MPI_COMM_WORLD);
+  logger->log(&t->mpiBcastTime, "MPI_BCAST");
+
+  procDim = bCastData[0];
+  blockDim = bCastData[1];
+  rows = bCastData[2];
+  columns = bCastData[3];
+
+  dim[0] = procDim;
+  dim[1] = procDim;
+  period[0] = 1;
+  period[1] = 1;
+  reorder = 1;
+  logger->log(&t->compTime, "COMP");
+
+  MPI_Cart_create(MPI_COMM_WORLD, 2, dim, period, reorder, &cartComm);
+  logger->log(&t->mpiCartTime, "MPI_Cart_create");
+
+  // Allocate local blocks for A and B
+  allocMatrix(&localA, blockDim, blockDim, matrixFlags);
+  allocMatrix(&localB, blockDim, blockDim, matrixFlags);
+
+  // Create datatype to describe the subarrays of the global array
+  int globalSize[2] = {rows, columns};
+  int localSize[2] = {blockDim, blockDim};
+  int starts[2] = {0, 0};
+  logger->log(&t->compTime, "COMP");
+
+  MPI_Datatype type, subarrtype;
+  MPI_Type_create_subarray(2, globalSize, localSize, starts, MPI_ORDER_C, elemType, &type);
+  MPI_Type_create_resized(type, 0, blockDim * sizeof(T), &subarrtype);
+  MPI_Type_commit(&subarrtype);
+  logger->log(&t->mpiTypeTime, "MPI_Type_");
+
+  T *globalptrA = NULL;
+  T *globalptrB = NULL;
+  T *globalptrC = NULL;
+  if (rank == 0 && !blocksOnRanks(opt))
+  {
+    globalptrA = &(A[0][0]);
+    globalptrB = &(B[0][0]);
+    globalptrC = &(C[0][0]);
+  }
+
+  // Scatter the array to all processors
+  int *sendCounts = (int *)malloc(sizeof(int) * worldSize);
+  int *displacements = (int *)malloc(sizeof(int) * worldSize);
+
+  if (rank == 0)
+  {
+    for (int i = 0; i < worldSize; i++)
+    {
+      sendCounts[i] = 1;
+    }
+    int disp = 0;
+    for (int i = 0; i < procDim; i++)
+    {
+      for (int j = 0; j < procDim; j++)
+      {
+        displacements[i * procDim + j] = disp;
+        disp += 1;
+      }
+      disp += (blockDim - 1) * procDim;
+    }
+  }
+  logger->log(&t->compTime, "COMP");
+
+  if (blocksOnRanks(opt))
+  {
+    // Generate or read the blocks this rank would have received
+    MPI_Cart_coords(cartComm, rank, 2, coord);
+    loadBlocks(opt, cartComm, localA, localB, coord[0] * blockDim, blockDim, coord[1] * blockDim, blockDim, logger, t);
+  }
+  else
+  {
+    MPI_Scatterv(globalptrA, sendCounts, displacements, subarrtype, &(localA[0][0]),
+                 rows * columns / (worldSize), elemType,
+                 0, MPI_COMM_WORLD);
+    MPI_Scatterv(globalptrB, sendCounts, displacements, subarrtype, &(localB[0][0]),
+                 rows * columns / (worldSize), elemType,
+                 0, MPI_COMM_WORLD);
+    logger->log(&t->mpiScattervTime, "MPI_Scatterv");
+  }
+
+  if (allocMatrix(&localC, blockDim, blockDim, matrixFlags) != 0)
+  {
+    printf("[ERROR] Matrix alloc for localC in rank %d failed!\n", rank);
+    MPI_Abort(MPI_COMM_WORLD, 7);
+  }
+  logger->log(&t->compTime, "COMP");
+
+  // Initial skew
+  MPI_Cart_coords(cartComm, rank, 2, coord);
+  MPI_Cart_shift(cartComm, 1, coord[0], &left, &right);
+  logger->log(&t->mpiCartTime, "MPI_Cart_");
+
+  MPI_Sendrecv_replace(&(localA[0][0]), blockDim * blockDim, elemType, left, 1, right, 1, cartComm, MPI_STATUS_IGNORE);
+  logger->log(&t->mpiSendrecvReplaceTime, "MPI_Sendrecv_replace");
+
+  MPI_Cart_shift(cartComm, 0, coord[1], &up, &down);
+  logger->log(&t->mpiCartTime, "MPI_Cart_shift");
+
+  MPI_Sendrecv_replace(&(localB[0][0]), blockDim * blockDim, elemType, up, 1, down, 1, cartComm, MPI_STATUS_IGNORE);
+  t->shiftBytes += 2.0 * blockDim * blockDim * sizeof(T);
+  logger->log(&t->mpiSendrecvReplaceTime, "MPI_Sendrecv_replace");
+
+  // Init C
+  zeroLocal(blockDim, blockDim, &(localC[0][0]), blockDim);
+
+  cannonSteps(opt, procDim, blockDim, &localA, &localB, localC, cartComm, logger, t);
+
+  if (opt->outputC)
+  {
+    writeBlock(opt, cartComm, localC, coord[0] * blockDim, blockDim, coord[1] * blockDim, blockDim);
+    logger->log(&t->fileTime, "FILE");
+  }
+
+  if (opt->distributed)
+  {
+    *errors = verifyBlock(localC, coord[0] * blockDim, blockDim, coord[1] * blockDim, blockDim, opt->N);
+    logger->log(&t->verifyTime, "VERIFY");
+  }
+  else if (!blocksOnRanks(opt))
+  {
+    // Gather results
+    MPI_Gatherv(&(localC[0][0]), rows * columns / worldSize, elemType,
+                globalptrC, sendCounts, displacements, subarrtype,
+                0, MPI_COMM_WORLD);
+    logger->log(&t->mpiGathervTime, "MPI_Gatherv");
+  }
+
+  freeMatrix(&localC);
+}
+
+// 2.5D Cannon on a q x q x c grid. Layer 0 receives A and B and replicates
+// them on the c layers, layer l then runs q / c of the q Cannon steps
+// starting l * q / c blocks further along, and the partial C blocks are
+// summed onto layer 0. Each rank shifts sqrt(c) times fewer words than
+// Cannon on the same number of ranks, at c times the block memory.
+template <typename T>
+void cannon25DMultiply(const Options *opt, T **A, T **B, T **C, long *errors, Logger *logger, Timing *t)
+{
+  MPI_Comm cartComm, layerComm, depthComm;
+  int dim[3], period[3] = {1, 1, 0}, reorder = 0;
+  int layerDims[3] = {1, 1, 0}, depthDims[3] = {0, 0, 1};
+  int coord[3];
+  T **localA = NULL, **localB = NULL, **localC = NULL;
+  MPI_Datatype elemType = MpiTraits<T>::type();
+  int N = opt->N;
+  int layers = opt->layers;
+  int worldSize, rank;
+  int left, right, up, down;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &worldSize);
+
+  int procDim = (int)sqrt(worldSize / layers);
+  int blockDim = N / procDim;
+
+  dim[0] = procDim;
+  dim[1] = procDim;
+  dim[2] = layers;
+  logger->log(&t->compTime, "COMP");
+
+  // Without reordering world rank 0 is (0, 0, 0) and rank 0 of layer 0
+  MPI_Cart_create(MPI_COMM_WORLD, 3, dim, period, reorder, &cartComm);
+  MPI_Comm_rank(cartComm, &rank);
+  MPI_Cart_coords(cartComm, rank, 3, coord);
+  MPI_Cart_sub(cartComm, layerDims, &layerComm);
+  MPI_Cart_sub(cartComm, depthDims, &depthComm);
+  logger->log(&t->mpiCartTime, "MPI_Cart_");
+
+  if (allocMatrix(&localA, blockDim, blockDim, matrixFlags) != 0 || allocMatrix(&localB, blockDim, blockDim, matrixFlags) != 0 ||
+      allocMatrix(&localC, blockDim, blockDim, matrixFlags) != 0)
+  {
+    printf("[ERROR] Matrix alloc for local blocks in rank %d failed!\n", rank);
+    MPI_Abort(MPI_COMM_WORLD, 7);
+  }
+
+  int globalSize[2] = {N, N};
+  int localSize[2] = {blockDim, blockDim};
+  int starts[2] = {0, 0};
+  logger->log(&t->compTime, "COMP");
+
+  MPI_Datatype type, subarrtype;
+  MPI_Type_create_subarray(2, globalSize, localSize, starts, MPI_ORDER_C, elemType, &type);
+  MPI_Type_create_resized(type, 0, blockDim * sizeof(T), &subarrtype);
+  MPI_Type_commit(&subarrtype);
+  logger->log(&t->mpiTypeTime, "MPI_Type_");
+
+  int *sendCounts = (int *)malloc(sizeof(int) * procDim * procDim);
+  int *displacements = (int *)malloc(sizeof(int) * procDim * procDim);
+  int disp = 0;
+  for (int i = 0; i < procDim; i++)
+  {
+    for (int j = 0; j < procDim; j++)
+    {
+      sendCounts[i * procDim + j] = 1;
+      displacements[i * procDim + j] = disp;
+      disp += 1;
+    }
+    disp += (blockDim - 1) * procDim;
+  }
+
+  bool root = rank == 0 && !blocksOnRanks(opt);
+  T *globalptrA = root ? &(A[0][0]) : NULL;
+  T *globalptrB = root ? &(B[0][0]) : NULL;
+  T *globalptrC = root ? &(C[0][0]) : NULL;
+  logger->log(&t->compTime, "COMP");
+
+  if (blocksOnRanks(opt))
+  {
+    // Every layer generates or reads its replica directly
+    loadBlocks(opt, cartComm, localA, localB, coord[0] * blockDim, blockDim, coord[1] * blockDim, blockDim, logger, t);
+  }
+  else
+  {
+    // Scatter onto layer 0, then replicate along the depth
+    if (coord[2] == 0)
+    {
+      MPI_Scatterv(globalptrA, sendCounts, displacements, subarrtype, &(localA[0][0]),
+                   blockDim * blockDim, elemType, 0, layerComm);
+      MPI_Scatterv(globalptrB, sendCounts, displacements, subarrtype, &(localB[0][0]),
+                   blockDim * blockDim, elemType, 0, layerComm);
+    }
+    logger->log(&t->mpiScattervTime, "MPI_Scatterv");
+
+    MPI_Bcast(&(localA[0][0]), blockDim * blockDim, elemType, 0, depthComm);
+    MPI_Bcast(&(localB[0][0]), blockDim * blockDim, elemType, 0, depthComm);
+    logger->log(&t->mpiBcastTime, "MPI_Bcast");
+  }
+
+  // Initial skew, layer l starts layerSteps * l blocks further along
+  int layerSteps = procDim / layers;
+  int offset = coord[2] * layerSteps;
+
+  MPI_Cart_shift(cartComm, 1, coord[0] + offset, &left, &right);
+  logger->log(&t->mpiCartTime, "MPI_Cart_shift");
+
+  MPI_Sendrecv_replace(&(localA[0][0]), blockDim * blockDim, elemType, left, 1, right, 1, cartComm, MPI_STATUS_IGNORE);
+  logger->log(&t->mpiSendrecvReplaceTime, "MPI_Sendrecv_replace");
+
+  MPI_Cart_shift(cartComm, 0, coord[1] + offset, &up, &down);
+  logger->log(&t->mpiCartTime, "MPI_Cart_shift");
+
+  MPI_Sendrecv_replace(&(localB[0][0]), blockDim * blockDim, elemType, up, 1, down, 1, cartComm, MPI_STATUS_IGNORE);
+  t->shiftBytes += 2.0 * blockDim * blockDim * sizeof(T);
+  logger->log(&t->mpiSendrecvReplaceTime, "MPI_Sendrecv_replace");
+
+  zeroLocal(blockDim, blockDim, &(localC[0][0]), blockDim);
+
+  cannonSteps(opt, layerSteps, blockDim, &localA, &localB, localC, cartComm, logger, t);
+
+  // Sum the partial products of all layers onto layer 0
+  if (coord[2] == 0)
+  {
+    MPI_Reduce(MPI_IN_PLACE, &(localC[0][0]), blockDim * blockDim, elemType, MPI_SUM, 0, depthComm);
+  }
+  else
+  {
+    MPI_Reduce(&(localC[0][0]), NULL, blockDim * blockDim, elemType, MPI_SUM, 0, depthComm);
+  }
+  logger->log(&t->mpiReduceTime, "MPI_Reduce");
+
+  if (opt->outputC)
+  {
+    // Only layer 0 holds the summed blocks
+    writeBlock(opt, cartComm, localC, coord[0] * blockDim, coord[2] == 0 ? blockDim : 0, coord[1] * blockDim, blockDim);
+    logger->log(&t->fileTime, "FILE");
+  }
+
+  if (opt->distributed)
+  {
+    if (coord[2] == 0)
+    {
+      *errors = verifyBlock(localC, coord[0] * blockDim, blockDim, coord[1] * blockDim, blockDim, N);
+    }
+    logger->log(&t->verifyTime, "VERIFY");
+  }
+  else if (!blocksOnRanks(opt))
+  {
+    if (coord[2] == 0)
+    {
+      MPI_Gatherv(&(localC[0][0]), blockDim * blockDim, elemType,
+                  globalptrC, sendCounts, displacements, subarrtype,
+                  0, layerComm);
+    }
+    logger->log(&t->mpiGathervTime, "MPI_Gatherv");
+  }
+
+  MPI_Type_free(&subarrtype);
+  free(sendCounts);
+  free(displacements);
+  freeMatrix(&localA);
+  freeMatrix(&localB);
+  freeMatrix(&localC);
+  MPI_Comm_free(&layerComm);
+  MPI_Comm_free(&depthComm);
+  MPI_Comm_free(&cartComm);
+}
+
+// Describe each rank's (possibly ragged) block of the global N x N matrix for
+// MPI_Alltoallw, only the root moves data
+void summaBlockTypes(MPI_Comm cartComm, MPI_Datatype elemType, int root, int N, int *dim, int rank, int localCount,
+                     int *counts, int *displs, MPI_Datatype *types, int *localCounts, int *localDispls, MPI_Datatype *localTypes)
+{
+  int size;
+  MPI_Comm_size(cartComm, &size);
+
+  for (int r = 0; r < size; r++)
+  {
+    counts[r] = 0;
+    displs[r] = 0;
+    types[r] = elemType;
+    localCounts[r] = 0;
+    localDispls[r] = 0;
+    localTypes[r] = elemType;
+  }
+  localCounts[root] = localCount;
+
+  if (rank == root)
+  {
+    for (int r = 0; r < size; r++)
+    {
+      int coord[2], rowStart, rowCount, colStart, colCount;
+      MPI_Cart_coords(cartComm, r, 2, coord);
+      blockRange(N, dim[0], coord[0], &rowStart, &rowCount);
+      blockRange(N, dim[1], coord[1], &colStart, &colCount);
+
+      int globalSize[2] = {N, N};
+      int localSize[2] = {rowCount, colCount};
+      int starts[2] = {rowStart, colStart};
+      MPI_Type_create_subarray(2, globalSize, localSize, starts, MPI_ORDER_C, elemType, &types[r]);
+      MPI_Type_commit(&types[r]);
+      counts[r] = 1;
+    }
+  }
+}
+
+// Width of the SUMMA panel starting at k0: up to the next block boundary of
+// either A's column split or B's row split
+int summaPanelWidth(int N, int *dim, int k0)
+{
+  int aStart, aCount, bStart, bCount;
+  blockRange(N, dim[1], blockOwner(N, dim[1], k0), &aStart, &aCount);
+  blockRange(N, dim[0], blockOwner(N, dim[0], k0), &bStart, &bCount);
+
+  int end = aStart + aCount < bStart + bCount ? aStart + aCount : bStart + bCount;
+  return end - k0;
+}
+
+// Post the row broadcast of A[:, k0:k0+w] and the column broadcast of
+// B[k0:k0+w, :] for one SUMMA panel. Returns the B panel to multiply with
+template <typename T>
+T *summaPostPanel(int k0, int w, int N, int *dim, int *coord, int rowStart, int rowCount, int colStart, int colCount,
+                    T **localA, T **localB, T *panelA, T *panelB, MPI_Comm rowComm, MPI_Comm colComm,
+                    bool nonblocking, MPI_Request *reqs)
+{
+  // Owners of the panel: the process column holding these columns of A and
+  // the process row holding these rows of B
+  int ownerA = blockOwner(N, dim[1], k0);
+  int ownerB = blockOwner(N, dim[0], k0);
+  MPI_Datatype elemType = MpiTraits<T>::type();
+  T *bPtr = panelB;
+
+  if (coord[1] == ownerA)
+  {
+    for (int i = 0; i < rowCount; i++)
+    {
+      memcpy(panelA + (size_t)i * w, &(localA[i][k0 - colStart]), sizeof(T) * w);
+    }
+  }
+  if (coord[0] == ownerB)
+  {
+    bPtr = &(localB[k0 - rowStart][0]);
+  }
+
+  if (nonblocking)
+  {
+    MPI_Ibcast(panelA, rowCount * w, elemType, ownerA, rowComm, &reqs[0]);
+    MPI_Ibcast(bPtr, w * colCount, elemType, ownerB, colComm, &reqs[1]);
+  }
+  else
+  {
+    MPI_Bcast(panelA, rowCount * w, elemType, ownerA, rowComm);
+    MPI_Bcast(bPtr, w * colCount, elemType, ownerB, colComm);
+  }
+
+  return bPtr;
+}
+
+// SUMMA on a pr x pc grid from MPI_Dims_create. Blocks are balanced splits
+// of N so any process count and any N >= max(pr, pc) work.
+template <typename T>
+void summaMultiply(const Options *opt, T **A, T **B, T **C, long *errors, Logger *logger, Timing *t)
 {
-  // Allocate rows*cols contiguous items
-  int *p = (int *)malloc(sizeof(int *) * rows * cols);
-  if (!p)
+  MPI_Comm cartComm, rowComm, colComm;
+  MPI_Group worldGroup, cartGroup;
+  int dim[2] = {0, 0}, period[2] = {0, 0}, reorder = 1;
+  int rowDims[2] = {0, 1}, colDims[2] = {1, 0};
+  int coord[2];
+  T **localA = NULL, **localB = NULL, **localC = NULL;
+  MPI_Datatype elemType = MpiTraits<T>::type();
+  int N = opt->N;
+  int worldSize, rank, root, worldRoot = 0;
+  int rowStart, rowCount, colStart, colCount;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &worldSize);
+  MPI_Dims_create(worldSize, 2, dim);
+  logger->log(&t->compTime, "COMP");
+
+  MPI_Cart_create(MPI_COMM_WORLD, 2, dim, period, reorder, &cartComm);
+  MPI_Comm_rank(cartComm, &rank);
+  MPI_Cart_coords(cartComm, rank, 2, coord);
+  MPI_Cart_sub(cartComm, rowDims, &rowComm);
+  MPI_Cart_sub(cartComm, colDims, &colComm);
+  logger->log(&t->mpiCartTime, "MPI_Cart_");
+
+  // Rank of the world root (holding A, B and C) in the grid
+  MPI_Comm_group(MPI_COMM_WORLD, &worldGroup);
+  MPI_Comm_group(cartComm, &cartGroup);
+  MPI_Group_translate_ranks(worldGroup, 1, &worldRoot, cartGroup, &root);
+  MPI_Group_free(&worldGroup);
+  MPI_Group_free(&cartGroup);
+
+  blockRange(N, dim[0], coord[0], &rowStart, &rowCount);
+  blockRange(N, dim[1], coord[1], &colStart, &colCount);
+
+  if (allocMatrix(&localA, rowCount, colCount, matrixFlags) != 0 || allocMatrix(&localB, rowCount, colCount, matrixFlags) != 0 ||
+      allocMatrix(&localC, rowCount, colCount, matrixFlags) != 0)
+  {
+    printf("[ERROR] Matrix alloc for local blocks in rank %d failed!\n", rank);
+    MPI_Abort(MPI_COMM_WORLD, 7);
+  }
+
+  int *counts = (int *)malloc(sizeof(int) * worldSize);
+  int *displs = (int *)malloc(sizeof(int) * worldSize);
+  MPI_Datatype *types = (MPI_Datatype *)malloc(sizeof(MPI_Datatype) * worldSize);
+  int *localCounts = (int *)malloc(sizeof(int) * worldSize);
+  int *localDispls = (int *)malloc(sizeof(int) * worldSize);
+  MPI_Datatype *localTypes = (MPI_Datatype *)malloc(sizeof(MPI_Datatype) * worldSize);
+  logger->log(&t->compTime, "COMP");
+
+  T *globalptrA = NULL;
+  T *globalptrB = NULL;
+  T *globalptrC = NULL;
+
+  if (blocksOnRanks(opt))
   {
-    return -1;
+    loadBlocks(opt, cartComm, localA, localB, rowStart, rowCount, colStart, colCount, logger, t);
   }
-  // Allocate row pointers
-  *mat = (int **)malloc(rows * sizeof(int *));
-  if (!mat)
+  else
   {
-    free(p);
-    return -1;
+    summaBlockTypes(cartComm, elemType, root, N, dim, rank, rowCount * colCount,
+                    counts, displs, types, localCounts, localDispls, localTypes);
+    logger->log(&t->mpiTypeTime, "MPI_Type_");
+
+    if (rank == root)
+    {
+      globalptrA = &(A[0][0]);
+      globalptrB = &(B[0][0]);
+      globalptrC = &(C[0][0]);
+    }
+
+    // Scatter: the root sends each rank its block through a subarray type
+    MPI_Alltoallw(globalptrA, counts, displs, types, &(localA[0][0]), localCounts, localDispls, localTypes, cartComm);
+    MPI_Alltoallw(globalptrB, counts, displs, types, &(localB[0][0]), localCounts, localDispls, localTypes, cartComm);
+    logger->log(&t->mpiScattervTime, "MPI_Alltoallw");
   }
 
-  // Set up the pointers into the contiguous memory
-  for (int i = 0; i < rows; i++)
+  zeroLocal(rowCount, colCount, &(localC[0][0]), colCount);
+
+  // Panel widths are bounded by the smallest block of either split
+  int maxW = (N + dim[0] - 1) / dim[0];
+  if ((N + dim[1] - 1) / dim[1] < maxW)
   {
-    (*mat)[i] = &(p[i * cols]);
+    maxW = (N + dim[1] - 1) / dim[1];
   }
-  return 0;
-}
 
-int freeMatrix(int ***mat)
-{
-  free(&((*mat)[0][0]));
-  free(*mat);
-  return 0;
-}
+  T *panelA[2], *panelB[2];
+  for (int b = 0; b < 2; b++)
+  {
+    panelA[b] = (T *)malloc(sizeof(T) * rowCount * maxW);
+    panelB[b] = (T *)malloc(sizeof(T) * maxW * colCount);
+    if (!panelA[b] || !panelB[b])
+    {
+      printf("[ERROR] Panel alloc in rank %d failed!\n", rank);
+      MPI_Abort(MPI_COMM_WORLD, 8);
+    }
+  }
+  logger->log(&t->compTime, "COMP");
 
-void matrixMultiply(int **a, int **b, int rows, int cols, int ***c)
-{
-  for (int i = 0; i < rows; i++)
+  // The k dimension is cut at every block boundary of A's columns and B's
+  // rows, so each panel has a single owner in both directions
+  int k0 = 0;
+  int w = 0;
+  int cur = 0;
+  T *bPtr = NULL;
+
+  if (opt->overlap)
   {
-    for (int j = 0; j < cols; j++)
+    MPI_Request reqs[2];
+
+    w = summaPanelWidth(N, dim, k0);
+    bPtr = summaPostPanel(k0, w, N, dim, coord, rowStart, rowCount, colStart, colCount,
+                          localA, localB, panelA[cur], panelB[cur], rowComm, colComm, true, reqs);
+    MPI_Waitall(2, reqs, MPI_STATUSES_IGNORE);
+    logger->log(&t->mpiBcastTime, "MPI_Ibcast");
+
+    while (k0 < N)
     {
-      int val = 0;
-      for (int k = 0; k < rows; k++)
+      // Post the next panel into the spare buffers
+      int nk = k0 + w;
+      int nw = 0;
+      T *nextB = NULL;
+      int nReqs = 0;
+      if (nk < N)
       {
-        val += a[i][k] * b[k][j];
+        nw = summaPanelWidth(N, dim, nk);
+        nextB = summaPostPanel(nk, nw, N, dim, coord, rowStart, rowCount, colStart, colCount,
+                               localA, localB, panelA[1 - cur], panelB[1 - cur], rowComm, colComm, true, reqs);
+        nReqs = 2;
       }
-      (*c)[i][j] = val;
+      logger->log(&t->mpiBcastTime, "MPI_Ibcast");
+
+      double hidden = multiplyOverlapped(rowCount, colCount, w, panelA[cur], w, bPtr, colCount, &(localC[0][0]), colCount,
+                                         nReqs, reqs);
+      t->flops += 2.0 * rowCount * colCount * w;
+      t->shiftBytes += (double)(rowCount + colCount) * w * sizeof(T);
+      logger->log(&t->compTime, "COMP");
+
+      if (nReqs > 0)
+      {
+        logger->record(&t->hiddenTime, hidden, "HIDDEN");
+      }
+
+      MPI_Waitall(nReqs, reqs, MPI_STATUSES_IGNORE);
+      logger->log(&t->mpiBcastTime, "MPI_Waitall");
+
+      k0 = nk;
+      w = nw;
+      bPtr = nextB;
+      cur = 1 - cur;
     }
   }
-}
-
-void printMatrix(int **mat, int size)
-{
-  for (int i = 0; i < size; i++)
+  else
   {
-    for (int j = 0; j < size; j++)
+    while (k0 < N)
     {
-      printf("%d ", mat[i][j]);
+      w = summaPanelWidth(N, dim, k0);
+      logger->log(&t->compTime, "COMP");
+
+      bPtr = summaPostPanel(k0, w, N, dim, coord, rowStart, rowCount, colStart, colCount,
+                            localA, localB, panelA[0], panelB[0], rowComm, colComm, false, NULL);
+      logger->log(&t->mpiBcastTime, "MPI_Bcast");
+
+      localMultiplyAdd(rowCount, colCount, w, panelA[0], w, bPtr, colCount, &(localC[0][0]), colCount);
+      t->flops += 2.0 * rowCount * colCount * w;
+      t->shiftBytes += (double)(rowCount + colCount) * w * sizeof(T);
+      logger->log(&t->compTime, "COMP");
+
+      k0 += w;
     }
-    printf("\n");
   }
-}
-
-int main(int argc, char *argv[])
-{
-  char *cp;
-  long LN;
-  int N;
 
-  // Check for the right number of arguments
-  if (argc != 2)
+  if (opt->outputC)
   {
-    fprintf(stderr, "[ERROR] Must be run with exactly 1 argument, found %d!\nUsage: %s <N>\n", argc - 1, argv[0]);
-    exit(1);
+    writeBlock(opt, cartComm, localC, rowStart, rowCount, colStart, colCount);
+    logger->log(&t->fileTime, "FILE");
   }
 
-  cp = argv[1];
-  if (*cp == 0)
+  if (opt->distributed)
   {
-    fprintf(stderr, "[ERROR] Argument is an empty string\n");
-    exit(1);
+    *errors = verifyBlock(localC, rowStart, rowCount, colStart, colCount, N);
+    logger->log(&t->verifyTime, "VERIFY");
   }
-
-  LN = strtol(cp, &cp, 10);
-  if (*cp != 0)
+  else if (!blocksOnRanks(opt))
   {
-    fprintf(stderr, "[ERROR] Argument '%s' is not an integer -- '%s'\n", argv[1], cp);
-    exit(1);
+    // Gather: every rank sends its block to the root's subarray
+    MPI_Alltoallw(&(localC[0][0]), localCounts, localDispls, localTypes, globalptrC, counts, displs, types, cartComm);
+    logger->log(&t->mpiGathervTime, "MPI_Alltoallw");
   }
 
-  N = (int)LN;
+  if (rank == root && !blocksOnRanks(opt))
+  {
+    for (int r = 0; r < worldSize; r++)
+    {
+      MPI_Type_free(&types[r]);
+    }
+  }
+  for (int b = 0; b < 2; b++)
+  {
+    free(panelA[b]);
+    free(panelB[b]);
+  }
+  free(counts);
+  free(displs);
+  free(types);
+  free(localCounts);
+  free(localDispls);
+  free(localTypes);
+  freeMatrix(&localA);
+  freeMatrix(&localB);
+  freeMatrix(&localC);
+  MPI_Comm_free(&rowComm);
+  MPI_Comm_free(&colComm);
+  MPI_Comm_free(&cartComm);
+}
 
-  MPI_Comm cartComm;
-  int dim[2], period[2], reorder;
-  int coord[2], id;
-  int **A = NULL, **B = NULL, **C = NULL;
-  int **localA = NULL, **localB = NULL, **localC = NULL;
-  int **localARec = NULL, **localBRec = NULL;
+// Root setup, the selected engine and the timing for element type T
+template <typename T>
+void run(const Options *opt, long *errors, Logger *logger, Timing *t)
+{
+  T **A = NULL, **B = NULL, **C = NULL;
+  int N = opt->N;
   int rows = N;
   int columns = N;
-  int worldSize;
-  int procDim;
-  int blockDim;
-  int left, right, up, down;
-  int bCastData[4];
-  int i, j, k;
+  int worldSize, rank;
+  int i, j;
 
   struct timeval start, stop;
 
-  // Initialize the MPI environment
-  MPI_Init(&argc, &argv);
-
-  // World size
   MPI_Comm_size(MPI_COMM_WORLD, &worldSize);
-
-  // Get the rank of the process
-  int rank;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-  std::stringstream tl;
-  tl << std::setw(2) << rank << ": [INFO] Timeline: ";
-
-  double compTime = 0;
-  double mpiBcastTime = 0.0;
-  double mpiTypeTime = 0.0;
-  double mpiScattervTime = 0.0;
-  double mpiCartTime = 0.0;
-  double mpiGathervTime = 0.0;
-  double mpiSendrecvReplaceTime = 0.0;
-
-  // start profiling
-  Logger logger(&tl);
-
   if (rank == 0)
   {
-    // Check matrix and world size
-    if (columns != rows)
+    if (!blocksOnRanks(opt) && allocMatrix(&A, rows, columns, matrixFlags) != 0)
     {
-      printf("[ERROR] Matrix must be square!\n");
-      MPI_Abort(MPI_COMM_WORLD, 2);
+      printf("[ERROR] Matrix alloc for A failed!\n");
+      MPI_Abort(MPI_COMM_WORLD, 4);
     }
 
-    double sqroot = sqrt(worldSize);
-    if ((sqroot - floor(sqroot)) != 0)
+    if (!blocksOnRanks(opt) && allocMatrix(&B, rows, columns, matrixFlags) != 0)
     {
-      printf("[ERROR] Number of processes must be a perfect square!\n");
-      MPI_Abort(MPI_COMM_WORLD, 2);
+      printf("[ERROR] Matrix alloc for B failed!\n");
+      MPI_Abort(MPI_COMM_WORLD, 5);
     }
 
-    int intRoot = (int)sqroot;
-    if (columns % intRoot != 0 || rows % intRoot != 0)
+    fprintf(stdout, "Matrix N = %d\n", N);
+    fprintf(stdout, "Element type: %s (%d bytes)\n", MpiTraits<T>::name(), (int)sizeof(T));
+    if (opt->strassen)
     {
-      printf("[ERROR] Number of rows/columns not divisible by %d!\n", intRoot);
-      MPI_Abort(MPI_COMM_WORLD, 3);
+      fprintf(stdout, "Kernel: %s, strassen (cutoff %d)\n", gemmIsaName(gemmIsa()), opt->cutoff);
     }
-
-    procDim = intRoot;
-    blockDim = columns / intRoot;
-
-    if (allocMatrix(&A, rows, columns) != 0)
+    else
     {
-      printf("[ERROR] Matrix alloc for A failed!\n");
-      MPI_Abort(MPI_COMM_WORLD, 4);
+      fprintf(stdout, "Kernel: %s\n", gemmIsaName(gemmIsa()));
     }
-
-    if (allocMatrix(&B, rows, columns) != 0)
+    fprintf(stdout, "Threads per rank: %d\n", opt->threads);
+    if (opt->engine == ENGINE_SUMMA)
     {
-      printf("[ERROR] Matrix alloc for B failed!\n");
-      MPI_Abort(MPI_COMM_WORLD, 5);
+      int dim[2] = {0, 0};
+      MPI_Dims_create(worldSize, 2, dim);
+      fprintf(stdout, "Engine: summa (%d x %d grid)\n", dim[0], dim[1]);
+    }
+    else if (opt->engine == ENGINE_25D)
+    {
+      int q = (int)sqrt(worldSize / opt->layers);
+      fprintf(stdout, "Engine: 2.5d (%d x %d x %d grid)\n", q, q, opt->layers);
+    }
+    else
+    {
+      fprintf(stdout, "Engine: cannon\n");
+    }
+    if (opt->overlap)
+    {
+      fprintf(stdout, "Overlapped shifts\n");
+    }
+    if (opt->persistent)
+    {
+      fprintf(stdout, "Persistent shift requests\n");
+    }
+    if (opt->shared)
+    {
+      fprintf(stdout, "Shared-memory window shifts\n");
+    }
+    if (opt->hugePages)
+    {
+      fprintf(stdout, "Huge pages for matrices of 2 MiB and more\n");
+    }
+    if (opt->distributed)
+    {
+      fprintf(stdout, "Distributed generation and verification\n");
+    }
+    const char *ioName = opt->io == MATRIX_IO_MMAP ? "mmap" : opt->io == MATRIX_IO_MPIIO ? "MPI-IO" : "auto";
+    if (opt->inputA)
+    {
+      fprintf(stdout, "A and B read from %s and %s (%s)\n", opt->inputA, opt->inputB, ioName);
+    }
+    if (opt->outputC)
+    {
+      fprintf(stdout, "C written to %s (%s)\n", opt->outputC, ioName);
     }
-
-    fprintf(stdout, "Matrix N = %d\n", N);
 
     // Generate Matrices
-    for (i = 0; i < N; i++)
+    for (i = 0; i < N && !blocksOnRanks(opt); i++)
     {
       for (j = 0; j < N; j++)
       {
@@ -191,191 +1715,216 @@ int main(int argc, char *argv[])
 
     gettimeofday(&start, 0);
 
-    if (allocMatrix(&C, rows, columns) != 0)
+    if (!blocksOnRanks(opt) && allocMatrix(&C, rows, columns, matrixFlags) != 0)
     {
       printf("[ERROR] Matrix alloc for C failed!\n");
       MPI_Abort(MPI_COMM_WORLD, 6);
     }
-
-    bCastData[0] = procDim;
-    bCastData[1] = blockDim;
-    bCastData[2] = rows;
-    bCastData[3] = columns;
   }
-  logger.log(&compTime, "COMP");
-
-  // Create 2D Cartesian grid of processes
-  MPI_Bcast(&bCastData, 4, MPI_INT, 0, MPI_COMM_WORLD);
-  logger.log(&mpiBcastTime, "MPI_BCAST");
-
-  procDim = bCastData[0];
-  blockDim = bCastData[1];
-  rows = bCastData[2];
-  columns = bCastData[3];
-
-  dim[0] = procDim;
-  dim[1] = procDim;
-  period[0] = 1;
-  period[1] = 1;
-  reorder = 1;
-  logger.log(&compTime, "COMP");
 
-  MPI_Cart_create(MPI_COMM_WORLD, 2, dim, period, reorder, &cartComm);
-  logger.log(&mpiCartTime, "MPI_Cart_create");
-
-  // Allocate local blocks for A and B
-  allocMatrix(&localA, blockDim, blockDim);
-  allocMatrix(&localB, blockDim, blockDim);
-
-  // Create datatype to describe the subarrays of the global array
-  int globalSize[2] = {rows, columns};
-  int localSize[2] = {blockDim, blockDim};
-  int starts[2] = {0, 0};
-  logger.log(&compTime, "COMP");
-
-  MPI_Datatype type, subarrtype;
-  MPI_Type_create_subarray(2, globalSize, localSize, starts, MPI_ORDER_C, MPI_INT, &type);
-  MPI_Type_create_resized(type, 0, blockDim * sizeof(int), &subarrtype);
-  MPI_Type_commit(&subarrtype);
-  logger.log(&mpiTypeTime, "MPI_Type_");
-
-  int *globalptrA = NULL;
-  int *globalptrB = NULL;
-  int *globalptrC = NULL;
-  if (rank == 0)
+  if (opt->engine == ENGINE_SUMMA)
   {
-    globalptrA = &(A[0][0]);
-    globalptrB = &(B[0][0]);
-    globalptrC = &(C[0][0]);
+    summaMultiply(opt, A, B, C, errors, logger, t);
+  }
+  else if (opt->engine == ENGINE_25D)
+  {
+    cannon25DMultiply(opt, A, B, C, errors, logger, t);
+  }
+  else
+  {
+    cannonMultiply(opt, A, B, C, errors, logger, t);
   }
-
-  // Scatter the array to all processors
-  int *sendCounts = (int *)malloc(sizeof(int) * worldSize);
-  int *displacements = (int *)malloc(sizeof(int) * worldSize);
 
   if (rank == 0)
   {
-    for (int i = 0; i < worldSize; i++)
+    // printf("C is:\n");
+    // printMatrix(C, rows);
+
+    gettimeofday(&stop, 0);
+
+    // Reading A and B and writing C are timed apart, so GFLOP/s compares
+    // with generated matrices
+    double elapsed = (stop.tv_sec + stop.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6) - t->fileTime;
+    if (opt->inputA || opt->outputC)
     {
-      sendCounts[i] = 1;
+      fprintf(stdout, "File = %.6f\n", t->fileTime);
     }
-    int disp = 0;
-    for (int i = 0; i < procDim; i++)
+    fprintf(stdout, "Time = %.6f\n", elapsed);
+    fprintf(stdout, "GFLOP/s = %.3f\n\n", 2.0 * N * N * N / elapsed * 1e-9);
+
+    if (!blocksOnRanks(opt))
     {
-      for (int j = 0; j < procDim; j++)
-      {
-        displacements[i * procDim + j] = disp;
-        disp += 1;
-      }
-      disp += (blockDim - 1) * procDim;
+      freeMatrix(&A);
+      freeMatrix(&B);
+      freeMatrix(&C);
     }
   }
-  logger.log(&compTime, "COMP");
+}
+
+int main(int argc, char *argv[])
+{
+  Options opt;
+  int rows, columns, N;
+  int worldSize;
 
-  MPI_Scatterv(globalptrA, sendCounts, displacements, subarrtype, &(localA[0][0]),
-               rows * columns / (worldSize), MPI_INT,
-               0, MPI_COMM_WORLD);
-  MPI_Scatterv(globalptrB, sendCounts, displacements, subarrtype, &(localB[0][0]),
-               rows * columns / (worldSize), MPI_INT,
-               0, MPI_COMM_WORLD);
-  logger.log(&mpiScattervTime, "MPI_Scatterv");
+  parseArgs(argc, argv, &opt);
+  N = opt.N;
+  rows = N;
+  columns = N;
 
-  if (allocMatrix(&localC, blockDim, blockDim) != 0)
+  // Initialize the MPI environment, only the main thread calls MPI
+  int provided;
+  MPI_Init_thread(&argc, &argv, opt.threads > 1 ? MPI_THREAD_FUNNELED : MPI_THREAD_SINGLE, &provided);
+  if (opt.threads > 1 && provided < MPI_THREAD_FUNNELED)
   {
-    printf("[ERROR] Matrix alloc for localC in rank %d failed!\n", rank);
-    MPI_Abort(MPI_COMM_WORLD, 7);
+    fprintf(stderr, "[ERROR] MPI library does not support MPI_THREAD_FUNNELED!\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
   }
-  logger.log(&compTime, "COMP");
 
-  // Initial skew
-  MPI_Cart_coords(cartComm, rank, 2, coord);
-  MPI_Cart_shift(cartComm, 1, coord[0], &left, &right);
-  logger.log(&mpiCartTime, "MPI_Cart_");
+  ThreadPool pool(opt.threads);
+  threadPool = &pool;
+  strassenCutoff = opt.strassen ? opt.cutoff : 0;
+  matrixFlags = opt.hugePages ? MATRIX_HUGE_PAGES : MATRIX_CONTIGUOUS;
 
-  MPI_Sendrecv_replace(&(localA[0][0]), blockDim * blockDim, MPI_INT, left, 1, right, 1, cartComm, MPI_STATUS_IGNORE);
-  logger.log(&mpiSendrecvReplaceTime, "MPI_Sendrecv_replace");
+  // World size
+  MPI_Comm_size(MPI_COMM_WORLD, &worldSize);
 
-  MPI_Cart_shift(cartComm, 0, coord[1], &up, &down);
-  logger.log(&mpiCartTime, "MPI_Cart_shift");
+  // Get the rank of the process
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-  MPI_Sendrecv_replace(&(localB[0][0]), blockDim * blockDim, MPI_INT, up, 1, down, 1, cartComm, MPI_STATUS_IGNORE);
-  logger.log(&mpiSendrecvReplaceTime, "MPI_Sendrecv_replace");
+  std::stringstream tl;
+  tl << std::setw(2) << rank << ": [INFO] Timeline: ";
 
-  // Init C
-  for (int i = 0; i < blockDim; i++)
+  Timing t;
+  long errors = 0;
+
+  // start profiling
+  Logger logger(&tl);
+
+  if (rank == 0)
   {
-    for (int j = 0; j < blockDim; j++)
+    // Check matrix and world size
+    if (columns != rows)
     {
-      localC[i][j] = 0;
+      printf("[ERROR] Matrix must be square!\n");
+      MPI_Abort(MPI_COMM_WORLD, 2);
     }
-  }
 
-  int **multiplyRes = NULL;
-  if (allocMatrix(&multiplyRes, blockDim, blockDim) != 0)
-  {
-    printf("[ERROR] Matrix alloc for multiplyRes in rank %d failed!\n", rank);
-    MPI_Abort(MPI_COMM_WORLD, 8);
-  }
-  logger.log(&compTime, "COMP");
+    if (opt.persistent && opt.shared)
+    {
+      printf("[ERROR] Persistent (-p) and shared-memory (-s) shifts cannot be combined!\n");
+      MPI_Abort(MPI_COMM_WORLD, 2);
+    }
 
-  for (int k = 0; k < procDim; k++)
-  {
-    matrixMultiply(localA, localB, blockDim, blockDim, &multiplyRes);
+    if (opt.engine == ENGINE_25D)
+    {
+      double sqroot = sqrt(worldSize / opt.layers);
+      if (worldSize % opt.layers != 0 || (sqroot - floor(sqroot)) != 0)
+      {
+        printf("[ERROR] Number of processes divided by %d layers must be a perfect square!\n", opt.layers);
+        MPI_Abort(MPI_COMM_WORLD, 2);
+      }
+
+      int intRoot = (int)sqroot;
+      if (intRoot % opt.layers != 0)
+      {
+        printf("[ERROR] Grid dimension %d not divisible by %d layers!\n", intRoot, opt.layers);
+        MPI_Abort(MPI_COMM_WORLD, 3);
+      }
 
-    for (int i = 0; i < blockDim; i++)
+      if (columns % intRoot != 0 || rows % intRoot != 0)
+      {
+        printf("[ERROR] Number of rows/columns not divisible by %d!\n", intRoot);
+        MPI_Abort(MPI_COMM_WORLD, 3);
+      }
+    }
+    else if (opt.engine == ENGINE_CANNON)
     {
-      for (int j = 0; j < blockDim; j++)
+      double sqroot = sqrt(worldSize);
+      if ((sqroot - floor(sqroot)) != 0)
       {
-        localC[i][j] += multiplyRes[i][j];
+        printf("[ERROR] Number of processes must be a perfect square! Use -e summa for any number of processes\n");
+        MPI_Abort(MPI_COMM_WORLD, 2);
+      }
+
+      int intRoot = (int)sqroot;
+      if (columns % intRoot != 0 || rows % intRoot != 0)
+      {
+        printf("[ERROR] Number of rows/columns not divisible by %d! Use -e summa for any N\n", intRoot);
+        MPI_Abort(MPI_COMM_WORLD, 3);
       }
     }
-    logger.log(&compTime, "COMP");
+    else
+    {
+      if (opt.persistent || opt.shared)
+      {
+        printf("[ERROR] Persistent (-p) and shared-memory (-s) shifts apply to the cannon and 2.5d engines only!\n");
+        MPI_Abort(MPI_COMM_WORLD, 2);
+      }
 
-    // Shift A once (left) and B once (up)
-    MPI_Cart_shift(cartComm, 1, 1, &left, &right);
-    MPI_Cart_shift(cartComm, 0, 1, &up, &down);
-    logger.log(&mpiCartTime, "MPI_Cart_shift");
+      int dim[2] = {0, 0};
+      MPI_Dims_create(worldSize, 2, dim);
+      if (N < dim[0] || N < dim[1])
+      {
+        printf("[ERROR] N must be at least %d for a %d x %d grid!\n", dim[0] > dim[1] ? dim[0] : dim[1], dim[0], dim[1]);
+        MPI_Abort(MPI_COMM_WORLD, 3);
+      }
+    }
 
-    MPI_Sendrecv_replace(&(localA[0][0]), blockDim * blockDim, MPI_INT, left, 1, right, 1, cartComm, MPI_STATUS_IGNORE);
-    MPI_Sendrecv_replace(&(localB[0][0]), blockDim * blockDim, MPI_INT, up, 1, down, 1, cartComm, MPI_STATUS_IGNORE);
-    logger.log(&mpiSendrecvReplaceTime, "MPI_Sendrecv_replace");
   }
 
-  // Gather results
-  MPI_Gatherv(&(localC[0][0]), rows * columns / worldSize, MPI_INT,
-              globalptrC, sendCounts, displacements, subarrtype,
-              0, MPI_COMM_WORLD);
-  logger.log(&mpiGathervTime, "MPI_Gatherv");
-
-  freeMatrix(&localC);
-  freeMatrix(&multiplyRes);
-
-  if (rank == 0)
+  if (opt.dataType == DATA_INT64)
   {
-    // printf("C is:\n");
-    // printMatrix(C, rows);
-
-    gettimeofday(&stop, 0);
+    run<long>(&opt, &errors, &logger, &t);
+  }
+  else if (opt.dataType == DATA_FLOAT)
+  {
+    run<float>(&opt, &errors, &logger, &t);
+  }
+  else if (opt.dataType == DATA_DOUBLE)
+  {
+    run<double>(&opt, &errors, &logger, &t);
+  }
+  else
+  {
+    run<int>(&opt, &errors, &logger, &t);
+  }
+  logger.log(&t.compTime, "COMP");
 
-    fprintf(stdout, "Time = %.6f\n\n",
-            (stop.tv_sec + stop.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6));
+  if (opt.distributed)
+  {
+    long totalErrors = 0;
+    MPI_Reduce(&errors, &totalErrors, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+      fprintf(stdout, "Verification: %s (%ld wrong entries)\n\n", totalErrors == 0 ? "PASSED" : "FAILED", totalErrors);
+    }
   }
-  logger.log(&compTime, "COMP");
 
   // Finalize the MPI environment
   MPI_Finalize();
 
-  double mpiTime = mpiBcastTime + mpiTypeTime + mpiScattervTime + mpiCartTime + mpiGathervTime + mpiSendrecvReplaceTime;
-  double totalTime = compTime + mpiTime;
+  double mpiTime = t.mpiBcastTime + t.mpiTypeTime + t.mpiScattervTime + t.mpiCartTime + t.mpiGathervTime + t.mpiSendrecvReplaceTime + t.mpiReduceTime;
+  double totalTime = t.compTime + mpiTime + t.fileTime;
+
+  // Panel broadcasts for summa, block shifts (with the skew) otherwise
+  double shiftTime = (opt.engine == ENGINE_SUMMA ? t.mpiBcastTime : t.mpiSendrecvReplaceTime) + t.hiddenTime;
 
-  std::cout << std::setw(2) << rank << ": [INFO] Bcst. time: " << std::setprecision(6) << mpiBcastTime << std::endl;
-  std::cout << std::setw(2) << rank << ": [INFO] Type  time: " << std::setprecision(6) << mpiTypeTime << std::endl;
-  std::cout << std::setw(2) << rank << ": [INFO] Sctr. time: " << std::setprecision(6) << mpiScattervTime << std::endl;
-  std::cout << std::setw(2) << rank << ": [INFO] Cart. time: " << std::setprecision(6) << mpiCartTime << std::endl;
-  std::cout << std::setw(2) << rank << ": [INFO] Gath. time: " << std::setprecision(6) << mpiGathervTime << std::endl;
-  std::cout << std::setw(2) << rank << ": [INFO] SndR. time: " << std::setprecision(6) << mpiSendrecvReplaceTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Bcst. time: " << std::setprecision(6) << t.mpiBcastTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Type  time: " << std::setprecision(6) << t.mpiTypeTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Sctr. time: " << std::setprecision(6) << t.mpiScattervTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Cart. time: " << std::setprecision(6) << t.mpiCartTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Gath. time: " << std::setprecision(6) << t.mpiGathervTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] SndR. time: " << std::setprecision(6) << t.mpiSendrecvReplaceTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Rdce. time: " << std::setprecision(6) << t.mpiReduceTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Hidn. time: " << std::setprecision(6) << t.hiddenTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] File  time: " << std::setprecision(6) << t.fileTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Vrfy. time: " << std::setprecision(6) << t.verifyTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Shft. GB/s: " << std::setprecision(6) << (shiftTime > 0 ? t.shiftBytes / shiftTime * 1e-9 : 0.0) << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Comp. GF/s: " << std::setprecision(6) << (t.compTime > 0 ? t.flops / t.compTime * 1e-9 : 0.0) << std::endl;
   std::cout << std::setw(2) << rank << ": [INFO] COMM. TIME: " << std::setprecision(6) << mpiTime << std::endl;
-  std::cout << std::setw(2) << rank << ": [INFO] COMP. TIME: " << std::setprecision(6) << compTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] COMP. TIME: " << std::setprecision(6) << t.compTime << std::endl;
   std::cout << std::setw(2) << rank << ": [INFO] TOTAL TIME: " << std::setprecision(6) << totalTime << std::endl;
   std::cout << tl.str() << std::endl;
 
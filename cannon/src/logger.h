@@ -35,4 +35,12 @@ public:
     *timeAgg += elapsed;
     *stream << tag << ':' << std::setprecision(PRECISION) << elapsed << ',';
   }
+
+  // Record a duration measured elsewhere (e.g. overlapped with another
+  // interval) without advancing the timeline clock
+  void record(double *timeAgg, double elapsed, std::string tag)
+  {
+    *timeAgg += elapsed;
+    *stream << tag << ':' << std::setprecision(PRECISION) << elapsed << ',';
+  }
 };
\ No newline at end of file
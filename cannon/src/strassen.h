@@ -0,0 +1,207 @@
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+// Strassen-Winograd multiply computing C += A * B on row-major blocks, on
+// top of the blocked kernel of gemm.h.
+//
+// Each level splits A, B and C into 2 x 2 quadrants (an odd last row,
+// column or k index is peeled off and handled by the blocked kernel) and
+// forms the product with 7 half-size multiplies instead of 8. Recursion
+// stops once any dimension drops below the cutoff.
+//
+// The sums of the quadrants and the partial products live in one arena per
+// thread, sized for the whole recursion before it starts: every level takes
+// its four temporaries from the front and hands the rest down.
+
+#include <stdlib.h>
+#include "../../common/gemm.h"
+
+// Temporaries of one level: S (m x k), T (k x n), W and P (m x n)
+inline size_t strassenLevelSize(int m, int n, int k)
+{
+  return (size_t)m * k + (size_t)k * n + 2 * (size_t)m * n;
+}
+
+// Arena elements needed by strassenMultiplyAdd(m, n, k, ...) at this cutoff
+inline size_t strassenWorkspaceSize(int m, int n, int k, int cutoff)
+{
+  size_t size = 0;
+  while (m >= cutoff && n >= cutoff && k >= cutoff && m >= 2 && n >= 2 && k >= 2)
+  {
+    m /= 2;
+    n /= 2;
+    k /= 2;
+    size += strassenLevelSize(m, n, k);
+  }
+  return size;
+}
+
+// Per-thread arena, grown on demand and reused across calls
+inline void *strassenArena(size_t bytes)
+{
+  static thread_local void *buf = NULL;
+  static thread_local size_t cap = 0;
+
+  if (cap < bytes)
+  {
+    free(buf);
+    if (posix_memalign(&buf, GEMM_ALIGN, bytes) != 0)
+    {
+      buf = NULL;
+      cap = 0;
+      return NULL;
+    }
+    cap = bytes;
+  }
+  return buf;
+}
+
+// Z = X + sy * Y (+ sw * W when W is given), sy and sw are +1 or -1
+template <typename T>
+void strassenCombine(int m, int n, const T *X, int ldx, const T *Y, int ldy, int sy,
+                     const T *W, int ldw, int sw, T *Z, int ldz)
+{
+  const T ty = (T)sy;
+  const T tw = (T)sw;
+  for (int i = 0; i < m; i++)
+  {
+    const T *x = X + (size_t)i * ldx;
+    const T *y = Y + (size_t)i * ldy;
+    T *z = Z + (size_t)i * ldz;
+    if (W)
+    {
+      const T *w = W + (size_t)i * ldw;
+      for (int j = 0; j < n; j++)
+      {
+        z[j] = x[j] + ty * y[j] + tw * w[j];
+      }
+    }
+    else
+    {
+      for (int j = 0; j < n; j++)
+      {
+        z[j] = x[j] + ty * y[j];
+      }
+    }
+  }
+}
+
+// Z += X
+template <typename T>
+void strassenAccumulate(int m, int n, const T *X, int ldx, T *Z, int ldz)
+{
+  for (int i = 0; i < m; i++)
+  {
+    const T *x = X + (size_t)i * ldx;
+    T *z = Z + (size_t)i * ldz;
+    for (int j = 0; j < n; j++)
+    {
+      z[j] += x[j];
+    }
+  }
+}
+
+template <typename T>
+void strassenZero(int m, int n, T *Z, int ldz)
+{
+  for (int i = 0; i < m; i++)
+  {
+    memset(Z + (size_t)i * ldz, 0, sizeof(T) * n);
+  }
+}
+
+template <typename T>
+void strassenRecurse(int m, int n, int k, const T *A, int lda, const T *B, int ldb, T *C, int ldc,
+                     int cutoff, T *work)
+{
+  if (m < cutoff || n < cutoff || k < cutoff || m < 2 || n < 2 || k < 2)
+  {
+    matrixMultiplyAdd(m, n, k, A, lda, B, ldb, C, ldc);
+    return;
+  }
+
+  int m2 = m / 2, n2 = n / 2, k2 = k / 2;
+
+  const T *A11 = A, *A12 = A + k2, *A21 = A + (size_t)m2 * lda, *A22 = A21 + k2;
+  const T *B11 = B, *B12 = B + n2, *B21 = B + (size_t)k2 * ldb, *B22 = B21 + n2;
+  T *C11 = C, *C12 = C + n2, *C21 = C + (size_t)m2 * ldc, *C22 = C21 + n2;
+
+  T *S = work;
+  T *Tm = S + (size_t)m2 * k2;
+  T *W = Tm + (size_t)k2 * n2;
+  T *P = W + (size_t)m2 * n2;
+  T *next = P + (size_t)m2 * n2;
+
+  // M1 = A11 B11, C11 += M1 + M2
+  strassenZero(m2, n2, W, n2);
+  strassenRecurse(m2, n2, k2, A11, lda, B11, ldb, W, n2, cutoff, next);
+  strassenAccumulate(m2, n2, W, n2, C11, ldc);
+  strassenRecurse(m2, n2, k2, A12, lda, B21, ldb, C11, ldc, cutoff, next);
+
+  // W = M1 + M6 with S2 = A21 + A22 - A11 and T2 = B22 - B12 + B11
+  strassenCombine(m2, k2, A21, lda, A22, lda, 1, A11, lda, -1, S, k2);
+  strassenCombine(k2, n2, B22, ldb, B12, ldb, -1, B11, ldb, 1, Tm, n2);
+  strassenRecurse(m2, n2, k2, S, k2, Tm, n2, W, n2, cutoff, next);
+
+  // C12 += M3 = (A12 - S2) B22
+  strassenCombine(m2, k2, A12, lda, S, k2, -1, (const T *)NULL, 0, 0, S, k2);
+  strassenRecurse(m2, n2, k2, S, k2, B22, ldb, C12, ldc, cutoff, next);
+
+  // C21 -= M4 = A22 (T2 - B21)
+  strassenCombine(k2, n2, B21, ldb, Tm, n2, -1, (const T *)NULL, 0, 0, Tm, n2);
+  strassenRecurse(m2, n2, k2, A22, lda, Tm, n2, C21, ldc, cutoff, next);
+
+  // M7 = (A11 - A21)(B22 - B12), then C12 += M1 + M6 and C21, C22 += M1 + M6 + M7
+  strassenCombine(m2, k2, A11, lda, A21, lda, -1, (const T *)NULL, 0, 0, S, k2);
+  strassenCombine(k2, n2, B22, ldb, B12, ldb, -1, (const T *)NULL, 0, 0, Tm, n2);
+  strassenZero(m2, n2, P, n2);
+  strassenRecurse(m2, n2, k2, S, k2, Tm, n2, P, n2, cutoff, next);
+  strassenAccumulate(m2, n2, W, n2, C12, ldc);
+  strassenAccumulate(m2, n2, P, n2, W, n2);
+  strassenAccumulate(m2, n2, W, n2, C21, ldc);
+  strassenAccumulate(m2, n2, W, n2, C22, ldc);
+
+  // M5 = (A21 + A22)(B12 - B11), C12, C22 += M5
+  strassenCombine(m2, k2, A21, lda, A22, lda, 1, (const T *)NULL, 0, 0, S, k2);
+  strassenCombine(k2, n2, B12, ldb, B11, ldb, -1, (const T *)NULL, 0, 0, Tm, n2);
+  strassenZero(m2, n2, P, n2);
+  strassenRecurse(m2, n2, k2, S, k2, Tm, n2, P, n2, cutoff, next);
+  strassenAccumulate(m2, n2, P, n2, C12, ldc);
+  strassenAccumulate(m2, n2, P, n2, C22, ldc);
+
+  // Peeled odd k column, n column and m row
+  int me = 2 * m2, ne = 2 * n2, ke = 2 * k2;
+  if (ke < k)
+  {
+    matrixMultiplyAdd(me, ne, k - ke, A + ke, lda, B + (size_t)ke * ldb, ldb, C, ldc);
+  }
+  if (ne < n)
+  {
+    matrixMultiplyAdd(me, n - ne, k, A, lda, B + ne, ldb, C + ne, ldc);
+  }
+  if (me < m)
+  {
+    matrixMultiplyAdd(m - me, n, k, A + (size_t)me * lda, lda, B, ldb, C + (size_t)me * ldc, ldc);
+  }
+}
+
+// C (m x n) += A (m x k) * B (k x n), Strassen-Winograd down to the cutoff
+template <typename T>
+void strassenMultiplyAdd(int m, int n, int k, const T *A, int lda, const T *B, int ldb, T *C, int ldc, int cutoff)
+{
+  size_t size = strassenWorkspaceSize(m, n, k, cutoff);
+  if (size == 0)
+  {
+    matrixMultiplyAdd(m, n, k, A, lda, B, ldb, C, ldc);
+    return;
+  }
+
+  T *work = (T *)strassenArena(sizeof(T) * size);
+  if (!work)
+  {
+    abort();
+  }
+  strassenRecurse(m, n, k, A, lda, B, ldb, C, ldc, cutoff, work);
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads running parallel-for loops. The calling
+// thread takes part in every loop, so a pool of size 1 starts no workers.
+// Only the calling thread is expected to use MPI (MPI_THREAD_FUNNELED).
+class ThreadPool
+{
+private:
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable finished;
+
+  const std::function<void(int)> *task = NULL;
+  int nTasks = 0;
+  int next = 0;
+  int remaining = 0;
+  unsigned long generation = 0;
+  bool stop = false;
+
+  // Run tasks of the current loop until none are left, lock must be held
+  void drain(std::unique_lock<std::mutex> &lock)
+  {
+    while (next < nTasks)
+    {
+      int idx = next++;
+      const std::function<void(int)> *fn = task;
+
+      lock.unlock();
+      (*fn)(idx);
+      lock.lock();
+
+      if (--remaining == 0)
+      {
+        finished.notify_all();
+      }
+    }
+  }
+
+  void work()
+  {
+    unsigned long seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+      wake.wait(lock, [&]
+                { return stop || generation != seen; });
+      if (stop)
+      {
+        return;
+      }
+      seen = generation;
+      drain(lock);
+    }
+  }
+
+public:
+  ThreadPool(int threads)
+  {
+    for (int i = 1; i < threads; i++)
+    {
+      workers.push_back(std::thread(&ThreadPool::work, this));
+    }
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+      workers[i].join();
+    }
+  }
+
+  int size()
+  {
+    return (int)workers.size() + 1;
+  }
+
+  // Run fn(0) .. fn(n - 1) across the pool and wait for all of them
+  void parallelFor(int n, const std::function<void(int)> &fn)
+  {
+    if (workers.empty() || n <= 1)
+    {
+      for (int i = 0; i < n; i++)
+      {
+        fn(i);
+      }
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    task = &fn;
+    nTasks = n;
+    next = 0;
+    remaining = n;
+    generation++;
+    wake.notify_all();
+
+    drain(lock);
+    finished.wait(lock, [&]
+                  { return remaining == 0; });
+    task = NULL;
+  }
+};
+
+#endif
@@ -0,0 +1,8 @@
+#!/bin/bash
+#SBATCH -p batch
+#SBATCH -o __LOG_NAME__
+#SBATCH -N __NUM_NODES__
+#SBATCH --nodelist=__NODE_LIST__
+
+# One rank per node, its threads must not be bound to a single core
+mpirun --mca btl_tcp_if_exclude docker0,lo --map-by ppr:1:node --bind-to none -np __NUM_PROCESSORS__ __O_FILE__ __MATRIX_N__ -t __NUM_THREADS__ __ARGS__
@@ -4,4 +4,4 @@
 #SBATCH -N __NUM_NODES__
 #SBATCH --nodelist=__NODE_LIST__
 
-mpirun --mca btl_tcp_if_exclude docker0,lo -np __NUM_PROCESSORS__ __O_FILE__ __MATRIX_N__
+mpirun --mca btl_tcp_if_exclude docker0,lo -np __NUM_PROCESSORS__ __O_FILE__ __MATRIX_N__ __ARGS__
@@ -0,0 +1,194 @@
+#ifndef ALIGNED_MATRIX_H
+#define ALIGNED_MATRIX_H
+
+// Dense row-major matrix storage shared by all programs (header only).
+//
+// The elements live in one contiguous buffer aligned to a cache line, so
+// whole matrices and row blocks go to MPI as a single buffer and the vector
+// kernels can load rows without splits. Options per matrix:
+//
+//   MATRIX_HUGE_PAGES  align buffers of 2 MiB and more to 2 MiB and ask for
+//                      transparent huge pages (fewer TLB misses when
+//                      streaming large operands)
+//   MATRIX_PADDED      pad the row stride to whole cache lines, plus one line
+//                      when a row is a multiple of 1 KiB, so walking down a
+//                      column does not keep hitting the same cache sets. Rows
+//                      are then no longer back to back: pass stride() as the
+//                      leading dimension and use strided MPI datatypes
+//
+// Allocation does not touch the pages. zeroRows() lets each thread (or rank)
+// touch the rows it is going to work on first, which places those pages on
+// its NUMA node.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define MATRIX_ALIGN 64
+#define MATRIX_HUGE_PAGE (2 * 1024 * 1024)
+
+enum MatrixFlags
+{
+  MATRIX_CONTIGUOUS = 0,
+  MATRIX_HUGE_PAGES = 1,
+  MATRIX_PADDED = 2
+};
+
+// Aligned, untouched buffer of at least bytes bytes, NULL on failure
+inline void *matrixBufferAlloc(size_t bytes, int flags)
+{
+  bool huge = (flags & MATRIX_HUGE_PAGES) && bytes >= MATRIX_HUGE_PAGE;
+  size_t align = huge ? MATRIX_HUGE_PAGE : MATRIX_ALIGN;
+  void *p = NULL;
+
+  bytes = (bytes + align - 1) / align * align;
+  if (bytes == 0)
+  {
+    bytes = align;
+  }
+  if (posix_memalign(&p, align, bytes) != 0)
+  {
+    return NULL;
+  }
+#ifdef MADV_HUGEPAGE
+  if (huge)
+  {
+    madvise(p, bytes, MADV_HUGEPAGE);
+  }
+#endif
+  return p;
+}
+
+// Elements from one row to the next
+inline int matrixStride(int cols, size_t elemSize, int flags)
+{
+  if (!(flags & MATRIX_PADDED))
+  {
+    return cols;
+  }
+
+  size_t line = MATRIX_ALIGN / elemSize;
+  size_t stride = (cols + line - 1) / line * line;
+  if ((stride * elemSize) % 1024 == 0)
+  {
+    stride += line;
+  }
+  return (int)stride;
+}
+
+template <typename T>
+class Matrix
+{
+private:
+  T *buf = NULL;
+  int nRows = 0;
+  int nCols = 0;
+  int ld = 0;
+
+public:
+  Matrix() {}
+
+  Matrix(int rows, int cols, int flags = MATRIX_CONTIGUOUS)
+  {
+    allocate(rows, cols, flags);
+  }
+
+  ~Matrix()
+  {
+    release();
+  }
+
+  Matrix(const Matrix &) = delete;
+  Matrix &operator=(const Matrix &) = delete;
+
+  // Returns 0 on success, -1 (and an empty matrix) when out of memory
+  int allocate(int rows, int cols, int flags = MATRIX_CONTIGUOUS)
+  {
+    release();
+
+    int stride = matrixStride(cols, sizeof(T), flags);
+    buf = (T *)matrixBufferAlloc(sizeof(T) * (size_t)rows * stride, flags);
+    if (!buf)
+    {
+      return -1;
+    }
+    nRows = rows;
+    nCols = cols;
+    ld = stride;
+    return 0;
+  }
+
+  void release()
+  {
+    free(buf);
+    buf = NULL;
+    nRows = nCols = ld = 0;
+  }
+
+  bool empty() const { return buf == NULL; }
+  int rows() const { return nRows; }
+  int cols() const { return nCols; }
+  int stride() const { return ld; }
+  bool contiguous() const { return ld == nCols; }
+
+  T *data() { return buf; }
+  const T *data() const { return buf; }
+
+  T *operator[](int i) { return buf + (size_t)i * ld; }
+  const T *operator[](int i) const { return buf + (size_t)i * ld; }
+
+  // Zero rows [first, first + count), called by whoever works on them next
+  void zeroRows(int first, int count)
+  {
+    if (contiguous())
+    {
+      memset(buf + (size_t)first * ld, 0, sizeof(T) * (size_t)count * ld);
+      return;
+    }
+    for (int i = first; i < first + count; i++)
+    {
+      memset(buf + (size_t)i * ld, 0, sizeof(T) * ld);
+    }
+  }
+};
+
+// Row table over a contiguous buffer from matrixBufferAlloc, for code that
+// passes matrices around as T **. MATRIX_PADDED is ignored: these matrices
+// are always sent to MPI as one block. Returns 0 on success
+template <typename T>
+int allocMatrix(T ***mat, int rows, int cols, int flags = MATRIX_CONTIGUOUS)
+{
+  T *p = (T *)matrixBufferAlloc(sizeof(T) * (size_t)rows * cols, flags & ~MATRIX_PADDED);
+  if (!p)
+  {
+    *mat = NULL;
+    return -1;
+  }
+
+  *mat = (T **)malloc(sizeof(T *) * (rows > 0 ? rows : 1));
+  if (!*mat)
+  {
+    free(p);
+    return -1;
+  }
+
+  (*mat)[0] = p;
+  for (int i = 1; i < rows; i++)
+  {
+    (*mat)[i] = p + (size_t)i * cols;
+  }
+  return 0;
+}
+
+template <typename T>
+void freeMatrix(T ***mat)
+{
+  if (*mat)
+  {
+    free((*mat)[0]);
+    free(*mat);
+    *mat = NULL;
+  }
+}
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+// Packed, register-tiled GEMM kernel computing C += A * B on row-major blocks.
+//
+// A (m x k), B (k x n) and C (m x n) are addressed through their leading
+// dimensions, so sub-blocks of larger matrices can be passed directly.
+// B is packed into NR-wide column strips and A into MR-tall row strips
+// (both zero padded) so the micro-kernel streams both operands with unit
+// stride and keeps the MR x NR tile of C in vector registers.
+//
+// The micro-kernel is written with GCC vector extensions and instantiated
+// for 64 (AVX-512), 32 (AVX2) and 16 byte (generic, SSE2 on x86-64) vectors.
+// The widest variant supported by the CPU is picked once at runtime.
+
+#include <stdlib.h>
+#include <string.h>
+
+// Register tile: MR rows of C times two vectors of columns
+#define GEMM_MR 6
+#define GEMM_NV 2
+
+// Cache blocking (elements): an MC x KC block of A stays in L2, a KC x NR
+// strip of B in L1 and the KC x NC panel of B in L3
+#define GEMM_MC 120
+#define GEMM_KC 256
+#define GEMM_NC 3072
+
+#define GEMM_ALIGN 64
+
+#define GEMM_INLINE inline __attribute__((always_inline))
+
+enum GemmIsa
+{
+  GEMM_GENERIC = 0,
+  GEMM_AVX2 = 1,
+  GEMM_AVX512 = 2
+};
+
+inline const char *gemmIsaName(GemmIsa isa)
+{
+  switch (isa)
+  {
+  case GEMM_AVX512:
+    return "avx512";
+  case GEMM_AVX2:
+    return "avx2";
+  default:
+    return "generic";
+  }
+}
+
+inline GemmIsa gemmDetectIsa()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+  {
+    return GEMM_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+  {
+    return GEMM_AVX2;
+  }
+#endif
+  return GEMM_GENERIC;
+}
+
+// Selected kernel, detected on first use
+inline GemmIsa gemmIsa()
+{
+  static GemmIsa isa = gemmDetectIsa();
+  return isa;
+}
+
+// Per-thread packing buffers, grown on demand and reused across calls
+inline void *gemmWorkspace(int slot, size_t bytes)
+{
+  static thread_local void *buf[2] = {NULL, NULL};
+  static thread_local size_t cap[2] = {0, 0};
+
+  if (cap[slot] < bytes)
+  {
+    free(buf[slot]);
+    if (posix_memalign(&buf[slot], GEMM_ALIGN, bytes) != 0)
+    {
+      buf[slot] = NULL;
+      cap[slot] = 0;
+      return NULL;
+    }
+    cap[slot] = bytes;
+  }
+  return buf[slot];
+}
+
+template <typename T, int VB>
+struct GemmVec
+{
+  typedef T type __attribute__((vector_size(VB)));
+};
+
+// Pack a kc x nc panel of B into NR-wide strips, zero padding the last strip
+template <typename T, int NR>
+GEMM_INLINE void gemmPackB(int kc, int nc, const T *B, int ldb, T *Bp)
+{
+  for (int j = 0; j < nc; j += NR)
+  {
+    int nr = nc - j < NR ? nc - j : NR;
+    for (int p = 0; p < kc; p++)
+    {
+      const T *src = B + (size_t)p * ldb + j;
+      int jj = 0;
+      for (; jj < nr; jj++)
+      {
+        Bp[jj] = src[jj];
+      }
+      for (; jj < NR; jj++)
+      {
+        Bp[jj] = 0;
+      }
+      Bp += NR;
+    }
+  }
+}
+
+// Pack an mc x kc block of A into MR-tall strips (column by column)
+template <typename T>
+GEMM_INLINE void gemmPackA(int mc, int kc, const T *A, int lda, T *Ap)
+{
+  for (int i = 0; i < mc; i += GEMM_MR)
+  {
+    int mr = mc - i < GEMM_MR ? mc - i : GEMM_MR;
+    for (int p = 0; p < kc; p++)
+    {
+      int ii = 0;
+      for (; ii < mr; ii++)
+      {
+        Ap[ii] = A[(size_t)(i + ii) * lda + p];
+      }
+      for (; ii < GEMM_MR; ii++)
+      {
+        Ap[ii] = 0;
+      }
+      Ap += GEMM_MR;
+    }
+  }
+}
+
+// C[0..mr)[0..nr) += Ap * Bp for one packed MR x NR tile
+template <typename T, int VB>
+GEMM_INLINE void gemmMicroKernel(int kc, const T *Ap, const T *Bp, T *C, int ldc, int mr, int nr)
+{
+  typedef typename GemmVec<T, VB>::type V;
+  const int W = VB / sizeof(T);
+  const int NR = GEMM_NV * W;
+
+  V c[GEMM_MR][GEMM_NV];
+  for (int i = 0; i < GEMM_MR; i++)
+  {
+    for (int v = 0; v < GEMM_NV; v++)
+    {
+      c[i][v] = (V){};
+    }
+  }
+
+  for (int p = 0; p < kc; p++)
+  {
+    V b[GEMM_NV];
+    for (int v = 0; v < GEMM_NV; v++)
+    {
+      b[v] = *(const V *)(Bp + v * W);
+    }
+
+#pragma GCC unroll 8
+    for (int i = 0; i < GEMM_MR; i++)
+    {
+      T a = Ap[i];
+      for (int v = 0; v < GEMM_NV; v++)
+      {
+        c[i][v] += a * b[v];
+      }
+    }
+
+    Ap += GEMM_MR;
+    Bp += NR;
+  }
+
+  if (mr == GEMM_MR && nr == NR)
+  {
+    for (int i = 0; i < GEMM_MR; i++)
+    {
+      for (int v = 0; v < GEMM_NV; v++)
+      {
+        V t;
+        memcpy(&t, C + (size_t)i * ldc + v * W, VB);
+        t += c[i][v];
+        memcpy(C + (size_t)i * ldc + v * W, &t, VB);
+      }
+    }
+  }
+  else
+  {
+    // Edge tile, only the valid part is written back
+    T tile[GEMM_MR][NR] __attribute__((aligned(GEMM_ALIGN)));
+    memcpy(tile, c, sizeof(tile));
+    for (int i = 0; i < mr; i++)
+    {
+      for (int j = 0; j < nr; j++)
+      {
+        C[(size_t)i * ldc + j] += tile[i][j];
+      }
+    }
+  }
+}
+
+template <typename T, int VB>
+GEMM_INLINE void gemmBlocked(int m, int n, int k, const T *A, int lda, const T *B, int ldb, T *C, int ldc)
+{
+  const int NR = GEMM_NV * (VB / (int)sizeof(T));
+  const int NC = GEMM_NC / NR * NR;
+
+  T *Ap = (T *)gemmWorkspace(0, sizeof(T) * GEMM_MC * GEMM_KC);
+  T *Bp = (T *)gemmWorkspace(1, sizeof(T) * GEMM_KC * NC);
+  if (!Ap || !Bp)
+  {
+    abort();
+  }
+
+  for (int jc = 0; jc < n; jc += NC)
+  {
+    int nc = n - jc < NC ? n - jc : NC;
+
+    for (int pc = 0; pc < k; pc += GEMM_KC)
+    {
+      int kc = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+
+      gemmPackB<T, NR>(kc, nc, B + (size_t)pc * ldb + jc, ldb, Bp);
+
+      for (int ic = 0; ic < m; ic += GEMM_MC)
+      {
+        int mc = m - ic < GEMM_MC ? m - ic : GEMM_MC;
+
+        gemmPackA<T>(mc, kc, A + (size_t)ic * lda + pc, lda, Ap);
+
+        for (int jr = 0; jr < nc; jr += NR)
+        {
+          int nr = nc - jr < NR ? nc - jr : NR;
+
+          for (int ir = 0; ir < mc; ir += GEMM_MR)
+          {
+            int mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+
+            gemmMicroKernel<T, VB>(kc, Ap + (size_t)ir * kc, Bp + (size_t)jr * kc,
+                                   C + (size_t)(ic + ir) * ldc + jc + jr, ldc, mr, nr);
+          }
+        }
+      }
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template <typename T>
+__attribute__((target("avx512f,avx512dq"))) void gemmAvx512(int m, int n, int k, const T *A, int lda, const T *B, int ldb, T *C, int ldc)
+{
+  gemmBlocked<T, 64>(m, n, k, A, lda, B, ldb, C, ldc);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma"))) void gemmAvx2(int m, int n, int k, const T *A, int lda, const T *B, int ldb, T *C, int ldc)
+{
+  gemmBlocked<T, 32>(m, n, k, A, lda, B, ldb, C, ldc);
+}
+#endif
+
+template <typename T>
+void gemmGeneric(int m, int n, int k, const T *A, int lda, const T *B, int ldb, T *C, int ldc)
+{
+  gemmBlocked<T, 16>(m, n, k, A, lda, B, ldb, C, ldc);
+}
+
+// C (m x n) += A (m x k) * B (k x n)
+template <typename T>
+void matrixMultiplyAdd(int m, int n, int k, const T *A, int lda, const T *B, int ldb, T *C, int ldc)
+{
+  if (m <= 0 || n <= 0 || k <= 0)
+  {
+    return;
+  }
+
+  switch (gemmIsa())
+  {
+#if defined(__x86_64__) || defined(__i386__)
+  case GEMM_AVX512:
+    gemmAvx512<T>(m, n, k, A, lda, B, ldb, C, ldc);
+    break;
+  case GEMM_AVX2:
+    gemmAvx2<T>(m, n, k, A, lda, B, ldb, C, ldc);
+    break;
+#endif
+  default:
+    gemmGeneric<T>(m, n, k, A, lda, B, ldb, C, ldc);
+    break;
+  }
+}
+
+#endif
@@ -0,0 +1,431 @@
+#ifndef MATRIX_FILE_H
+#define MATRIX_FILE_H
+
+// Binary matrix files read and written block by block by all ranks (header
+// only).
+//
+// A file is a 64 byte header followed by the elements in row-major order:
+//
+//   offset  size  field
+//        0     8  magic "PCMATRIX"
+//        8     4  element type (MatrixFileType)
+//       12     4  layout (MATRIX_FILE_ROW_MAJOR)
+//       16     8  rows
+//       24     8  columns
+//       32     4  byte order mark 0x01020304, as written by the producer
+//       36    28  reserved (zero)
+//
+// Every rank opens the file together and reads or writes only its own
+// rectangular block, no rank ever holds the whole matrix. Blocks go either
+// through collective MPI-IO on a subarray file view (MPI_File_read_at_all,
+// MPI_File_write_at_all), or, when all ranks share one node, through an mmap
+// of the file: the page cache is then the single copy and a block is a
+// plain memcpy of its rows. MATRIX_IO_AUTO picks mmap on a single node.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mpi.h>
+
+#define MATRIX_FILE_MAGIC "PCMATRIX"
+#define MATRIX_FILE_HEADER_SIZE 64
+#define MATRIX_FILE_BOM 0x01020304
+
+enum MatrixFileType
+{
+  MATRIX_FILE_INT32 = 1,
+  MATRIX_FILE_INT64 = 2,
+  MATRIX_FILE_FLOAT32 = 3,
+  MATRIX_FILE_FLOAT64 = 4
+};
+
+enum MatrixFileLayout
+{
+  MATRIX_FILE_ROW_MAJOR = 0
+};
+
+enum MatrixFileIo
+{
+  MATRIX_IO_AUTO,
+  MATRIX_IO_MPIIO,
+  MATRIX_IO_MMAP
+};
+
+// Return codes, see matrixFileError()
+enum MatrixFileStatus
+{
+  MATRIX_FILE_OK = 0,
+  MATRIX_FILE_EOPEN = -1,
+  MATRIX_FILE_EHEADER = -2,
+  MATRIX_FILE_ESIZE = -3,
+  MATRIX_FILE_EIO = -4
+};
+
+struct MatrixFileHeader
+{
+  char magic[8];
+  int32_t type;
+  int32_t layout;
+  int64_t rows;
+  int64_t cols;
+  uint32_t bom;
+  char reserved[28];
+};
+
+static_assert(sizeof(MatrixFileHeader) == MATRIX_FILE_HEADER_SIZE, "matrix file header must be 64 bytes");
+
+struct MatrixFile
+{
+  MatrixFileHeader header;
+  MPI_Comm comm;
+  bool mapped;
+  bool writable;
+  MPI_File fh;
+  char *map;
+  size_t mapBytes;
+};
+
+inline const char *matrixFileError(int status)
+{
+  switch (status)
+  {
+  case MATRIX_FILE_OK:
+    return "ok";
+  case MATRIX_FILE_EOPEN:
+    return "cannot open file";
+  case MATRIX_FILE_EHEADER:
+    return "not a matrix file, or written with another byte order";
+  case MATRIX_FILE_ESIZE:
+    return "file shorter than its header says";
+  default:
+    return "read or write failed";
+  }
+}
+
+inline const char *matrixFileTypeName(int type)
+{
+  switch (type)
+  {
+  case MATRIX_FILE_INT32:
+    return "int32";
+  case MATRIX_FILE_INT64:
+    return "int64";
+  case MATRIX_FILE_FLOAT32:
+    return "float";
+  case MATRIX_FILE_FLOAT64:
+    return "double";
+  default:
+    return "unknown";
+  }
+}
+
+inline size_t matrixFileTypeSize(int type)
+{
+  return type == MATRIX_FILE_INT64 || type == MATRIX_FILE_FLOAT64 ? 8 : 4;
+}
+
+inline size_t matrixFileBytes(const MatrixFileHeader *h)
+{
+  return MATRIX_FILE_HEADER_SIZE + (size_t)h->rows * h->cols * matrixFileTypeSize(h->type);
+}
+
+inline bool matrixFileHeaderValid(const MatrixFileHeader *h)
+{
+  return memcmp(h->magic, MATRIX_FILE_MAGIC, 8) == 0 && h->bom == MATRIX_FILE_BOM &&
+         h->layout == MATRIX_FILE_ROW_MAJOR && h->type >= MATRIX_FILE_INT32 && h->type <= MATRIX_FILE_FLOAT64 &&
+         h->rows >= 0 && h->cols >= 0;
+}
+
+// True when all ranks of comm run on one node
+inline bool matrixFileSingleNode(MPI_Comm comm)
+{
+  MPI_Comm nodeComm;
+  int size, nodeSize, all;
+
+  MPI_Comm_size(comm, &size);
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &nodeComm);
+  MPI_Comm_size(nodeComm, &nodeSize);
+  MPI_Comm_free(&nodeComm);
+
+  // Every rank has to take the same path
+  int single = nodeSize == size;
+  MPI_Allreduce(&single, &all, 1, MPI_INT, MPI_LAND, comm);
+  return all != 0;
+}
+
+// Map the whole file on every rank, 0 or -1
+inline int matrixFileMap(MatrixFile *f, const char *path, size_t bytes)
+{
+  int fd = open(path, f->writable ? O_RDWR : O_RDONLY);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  if (bytes == 0)
+  {
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+      close(fd);
+      return -1;
+    }
+    bytes = (size_t)st.st_size;
+  }
+
+  void *p = bytes > 0 ? mmap(NULL, bytes, f->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (p == MAP_FAILED)
+  {
+    return -1;
+  }
+  f->map = (char *)p;
+  f->mapBytes = bytes;
+  return 0;
+}
+
+// Collective over comm: open path for reading and check its header, which is
+// then in f->header on every rank
+inline int matrixFileOpen(MatrixFile *f, const char *path, MPI_Comm comm, int io)
+{
+  int status = MATRIX_FILE_OK, worst;
+
+  memset(f, 0, sizeof(*f));
+  f->comm = comm;
+  f->writable = false;
+  f->mapped = io == MATRIX_IO_MMAP || (io == MATRIX_IO_AUTO && matrixFileSingleNode(comm));
+
+  if (f->mapped)
+  {
+    if (matrixFileMap(f, path, 0) != 0)
+    {
+      status = MATRIX_FILE_EOPEN;
+    }
+    else if (f->mapBytes < MATRIX_FILE_HEADER_SIZE)
+    {
+      status = MATRIX_FILE_EHEADER;
+    }
+    else
+    {
+      memcpy(&f->header, f->map, MATRIX_FILE_HEADER_SIZE);
+    }
+  }
+  else
+  {
+    if (MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &f->fh) != MPI_SUCCESS)
+    {
+      return MATRIX_FILE_EOPEN;
+    }
+    if (MPI_File_read_at_all(f->fh, 0, &f->header, MATRIX_FILE_HEADER_SIZE, MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS)
+    {
+      status = MATRIX_FILE_EIO;
+    }
+  }
+
+  if (status == MATRIX_FILE_OK && !matrixFileHeaderValid(&f->header))
+  {
+    status = MATRIX_FILE_EHEADER;
+  }
+  if (status == MATRIX_FILE_OK)
+  {
+    MPI_Offset size = (MPI_Offset)f->mapBytes;
+    if (!f->mapped)
+    {
+      MPI_File_get_size(f->fh, &size);
+    }
+    if ((size_t)size < matrixFileBytes(&f->header))
+    {
+      status = MATRIX_FILE_ESIZE;
+    }
+  }
+
+  // Agree on the outcome, a rank that failed alone must not leave the
+  // others blocked in the next collective
+  MPI_Allreduce(&status, &worst, 1, MPI_INT, MPI_MIN, comm);
+  return worst;
+}
+
+// Collective over comm: create (or truncate) path for a rows x cols matrix of
+// the given element type, ready for matrixFileWriteBlock
+inline int matrixFileCreate(MatrixFile *f, const char *path, MPI_Comm comm, int type, int64_t rows, int64_t cols, int io)
+{
+  int rank, status = MATRIX_FILE_OK, worst;
+
+  memset(f, 0, sizeof(*f));
+  f->comm = comm;
+  f->writable = true;
+  f->mapped = io == MATRIX_IO_MMAP || (io == MATRIX_IO_AUTO && matrixFileSingleNode(comm));
+
+  memcpy(f->header.magic, MATRIX_FILE_MAGIC, 8);
+  f->header.type = type;
+  f->header.layout = MATRIX_FILE_ROW_MAJOR;
+  f->header.rows = rows;
+  f->header.cols = cols;
+  f->header.bom = MATRIX_FILE_BOM;
+
+  MPI_Comm_rank(comm, &rank);
+  size_t bytes = matrixFileBytes(&f->header);
+
+  if (f->mapped)
+  {
+    // Rank 0 lays the file out, then everyone maps it
+    if (rank == 0)
+    {
+      MatrixFileHeader header = f->header;
+      int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0 || ftruncate(fd, (off_t)bytes) != 0 ||
+          pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+      {
+        status = MATRIX_FILE_EOPEN;
+      }
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+    }
+    MPI_Allreduce(&status, &worst, 1, MPI_INT, MPI_MIN, comm);
+    if (worst != MATRIX_FILE_OK)
+    {
+      return worst;
+    }
+
+    if (matrixFileMap(f, path, bytes) != 0)
+    {
+      status = MATRIX_FILE_EOPEN;
+    }
+  }
+  else
+  {
+    if (MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &f->fh) != MPI_SUCCESS)
+    {
+      return MATRIX_FILE_EOPEN;
+    }
+    if (MPI_File_set_size(f->fh, (MPI_Offset)bytes) != MPI_SUCCESS)
+    {
+      status = MATRIX_FILE_EIO;
+    }
+    if (rank == 0 &&
+        MPI_File_write_at(f->fh, 0, &f->header, MATRIX_FILE_HEADER_SIZE, MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS)
+    {
+      status = MATRIX_FILE_EIO;
+    }
+  }
+
+  MPI_Allreduce(&status, &worst, 1, MPI_INT, MPI_MIN, comm);
+  return worst;
+}
+
+// Copy a block between the mapping and buf, rows are ld elements apart in buf
+inline void matrixFileCopyBlock(MatrixFile *f, int64_t rowStart, int rows, int64_t colStart, int cols,
+                                char *buf, int ld, bool toFile)
+{
+  size_t elem = matrixFileTypeSize(f->header.type);
+  size_t rowBytes = (size_t)cols * elem;
+
+  for (int i = 0; i < rows; i++)
+  {
+    char *p = f->map + MATRIX_FILE_HEADER_SIZE + ((size_t)(rowStart + i) * f->header.cols + colStart) * elem;
+    char *q = buf + (size_t)i * ld * elem;
+    if (toFile)
+    {
+      memcpy(p, q, rowBytes);
+    }
+    else
+    {
+      memcpy(q, p, rowBytes);
+    }
+  }
+}
+
+// Collective MPI-IO transfer of a block through a subarray view of the file
+inline int matrixFileTransferBlock(MatrixFile *f, int64_t rowStart, int rows, int64_t colStart, int cols,
+                                   void *buf, int ld, MPI_Datatype elemType, bool toFile)
+{
+  MPI_Datatype fileType = elemType, memType = elemType;
+  int count = 0;
+
+  if (rows > 0 && cols > 0)
+  {
+    int sizes[2] = {(int)f->header.rows, (int)f->header.cols};
+    int subSizes[2] = {rows, cols};
+    int starts[2] = {(int)rowStart, (int)colStart};
+
+    MPI_Type_create_subarray(2, sizes, subSizes, starts, MPI_ORDER_C, elemType, &fileType);
+    MPI_Type_commit(&fileType);
+    MPI_Type_vector(rows, cols, ld, elemType, &memType);
+    MPI_Type_commit(&memType);
+    count = 1;
+  }
+
+  // Ranks without a block still take part in the collective
+  int rc = MPI_File_set_view(f->fh, MATRIX_FILE_HEADER_SIZE, elemType, fileType, "native", MPI_INFO_NULL);
+  if (rc == MPI_SUCCESS)
+  {
+    rc = toFile ? MPI_File_write_at_all(f->fh, 0, buf, count, memType, MPI_STATUS_IGNORE)
+                : MPI_File_read_at_all(f->fh, 0, buf, count, memType, MPI_STATUS_IGNORE);
+  }
+
+  if (count > 0)
+  {
+    MPI_Type_free(&fileType);
+    MPI_Type_free(&memType);
+  }
+  return rc == MPI_SUCCESS ? MATRIX_FILE_OK : MATRIX_FILE_EIO;
+}
+
+// Collective over the file's comm: read the rows x cols block at (rowStart,
+// colStart) into buf, whose rows are ld elements apart. elemType must match
+// the element type of the file
+inline int matrixFileReadBlock(MatrixFile *f, int64_t rowStart, int rows, int64_t colStart, int cols,
+                               void *buf, int ld, MPI_Datatype elemType)
+{
+  if (f->mapped)
+  {
+    matrixFileCopyBlock(f, rowStart, rows, colStart, cols, (char *)buf, ld, false);
+    return MATRIX_FILE_OK;
+  }
+  return matrixFileTransferBlock(f, rowStart, rows, colStart, cols, buf, ld, elemType, false);
+}
+
+// Collective over the file's comm: write a block, the counterpart of
+// matrixFileReadBlock
+inline int matrixFileWriteBlock(MatrixFile *f, int64_t rowStart, int rows, int64_t colStart, int cols,
+                                const void *buf, int ld, MPI_Datatype elemType)
+{
+  if (f->mapped)
+  {
+    matrixFileCopyBlock(f, rowStart, rows, colStart, cols, (char *)buf, ld, true);
+    return MATRIX_FILE_OK;
+  }
+  return matrixFileTransferBlock(f, rowStart, rows, colStart, cols, (void *)buf, ld, elemType, true);
+}
+
+// Collective over the file's comm, written blocks are on disk afterwards
+inline void matrixFileClose(MatrixFile *f)
+{
+  if (f->mapped)
+  {
+    if (f->map)
+    {
+      if (f->writable)
+      {
+        msync(f->map, f->mapBytes, MS_SYNC);
+      }
+      munmap(f->map, f->mapBytes);
+    }
+    // Nobody reads the file back before all ranks have flushed their blocks
+    MPI_Barrier(f->comm);
+  }
+  else
+  {
+    MPI_File_close(&f->fh);
+  }
+  f->map = NULL;
+  f->mapBytes = 0;
+}
+
+#endif
@@ -35,12 +35,23 @@ matrix::matrix(int ix,
   temp_z = 0;
   size = (nx + 1) * (ny + 1);
 
-  // Dynamic memory allocation to ensure golden touch policy
-  v = new double[size]();
-  res = new double[size]();
-  d = new double[size]();
-  rhs = new double[size]();
-  z = new double[size]();
+  // Cache line aligned grids, zeroed here by the rank that works on them
+  // (first touch)
+  Matrix<double> *grids[] = {&vGrid, &resGrid, &dGrid, &rhsGrid, &zGrid};
+  for (Matrix<double> *g : grids)
+  {
+    if (g->allocate(ny + 1, nx + 1) != 0)
+    {
+      cerr << "[ERROR] Grid alloc failed!" << endl;
+      MPI_Abort(MPI_COMM_WORLD, 4);
+    }
+    g->zeroRows(0, ny + 1);
+  }
+  v = vGrid.data();
+  res = resGrid.data();
+  d = dGrid.data();
+  rhs = rhsGrid.data();
+  z = zGrid.data();
   temp_hx = 2 * PI * hx;
   temp_hy = 2 * PI * hy;
   k_2 = 4 * PI * PI;
@@ -358,10 +369,11 @@ void matrix::writetemp()
 
 void matrix::release()
 {
-  delete[] v;
-  delete[] res;
-  delete[] rhs;
-  delete[] d;
-  delete[] z;
+  vGrid.release();
+  resGrid.release();
+  rhsGrid.release();
+  dGrid.release();
+  zGrid.release();
+  v = res = rhs = d = z = NULL;
   pLogger->log(pCompTime, "COMP");
 };
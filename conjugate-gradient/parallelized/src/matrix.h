@@ -6,6 +6,7 @@
 #include <fstream>
 #include <sstream>
 #include "logger.h"
+#include "../../../common/aligned-matrix.h"
 
 #define PI 3.14159265358979323846
 
@@ -32,6 +33,9 @@ private:
   double k_2;
   double *res = NULL;
   int size;
+
+  // Storage behind v, res, d, rhs and z: (ny + 1) x (nx + 1) grids
+  Matrix<double> vGrid, resGrid, dGrid, rhsGrid, zGrid;
   double recp;
   int eps1;
 
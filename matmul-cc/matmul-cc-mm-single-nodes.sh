@@ -6,11 +6,18 @@ mkdir -p ${PWD}/{out,run,logs}
 # Src file name
 SRC_FILE="${PWD}/src/matmul-cc-mm.cpp"
 
+# Extra program arguments passed through from the command line, e.g. "-m ring"
+ARGS="$*"
+
+# Log and run file name suffix for ARGS, e.g. "-m ring" yields "-m-ring"
+SUFFIX=$(echo "$ARGS" | sed -e "s|^ *||" -e "s| *$||" -e "s| \+|-|g")
+SUFFIX=${SUFFIX:+-${SUFFIX}}
+
 # Compiled file name
 O_FILE="${PWD}/out/matmul-cc-mm.o"
 
 # Compile SRC_FILE and output it to O_FILE
-mpic++ $SRC_FILE -o $O_FILE
+mpic++ -O3 $SRC_FILE -o $O_FILE
 
 # Loop through N matrix dimensions
 for N in 256 512 1024 2048 4096
@@ -26,7 +33,7 @@ do
     printf -v PADDED_NP "%02d" $NP
 
     # Number of nodes required for corresponding NP
-    TASK="matmul-cc-mm-single-node-n${PADDED_N}-np${PADDED_NP}"
+    TASK="matmul-cc-mm-single-node-n${PADDED_N}-np${PADDED_NP}${SUFFIX}"
 
     # Log file name
     LOG_FILE="${PWD}/logs/${TASK}.out"
@@ -39,7 +46,7 @@ do
 
     # Run O_FILE the corresponding configurations
     echo "🏃 ${TASK}..."
-    mpirun --hostfile $HOST_FILE -np $NP $O_FILE $N | tee $LOG_FILE
+    mpirun --hostfile $HOST_FILE -np $NP $O_FILE $N $ARGS | tee $LOG_FILE
     echo "✅ ${TASK}"
   done
 done
@@ -1,38 +1,75 @@
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <vector>
 
 #include <mpi.h>
 
 #define PRECISION 8
 
+// Events reserved up front, more only grow the buffer
+#define LOGGER_RESERVE 1024
+
+// One timeline entry: the event ran from the end of the previous one (or the
+// creation of the logger) until end, both on this rank's MPI_Wtime() clock
+struct LogEvent
+{
+  const char *tag;
+  double end;
+};
+
+// Timeline of a rank. log() only reads the clock and appends to a buffer, so
+// it is cheap enough for the hot path; the text goes to the stream in flush()
 class Logger
 {
 private:
   std::iostream *stream;
-  double cts = MPI_Wtime();
+  double origin = MPI_Wtime();
+  double cts = origin;
+  std::vector<LogEvent> events;
 
-  double lapse()
+  double lapse(const char *tag)
   {
-    double elapsed = MPI_Wtime() - cts;
-    cts = MPI_Wtime();
+    double now = MPI_Wtime();
+    double elapsed = now - cts;
+    cts = now;
+    events.push_back({tag, now});
     return elapsed;
   }
 
 public:
-  Logger(std::iostream *tl) : stream(tl) {}
+  Logger(std::iostream *tl) : stream(tl)
+  {
+    events.reserve(LOGGER_RESERVE);
+  }
 
   void log(double *timeAgg)
   {
-    double elapsed = lapse();
-    *timeAgg += elapsed;
-    *stream << std::setprecision(PRECISION) << elapsed << ',';
+    *timeAgg += lapse(NULL);
   }
 
-  void log(double *timeAgg, std::string tag)
+  // tag must outlive the logger (a string literal)
+  void log(double *timeAgg, const char *tag)
+  {
+    *timeAgg += lapse(tag);
+  }
+
+  double start() const { return origin; }
+  const std::vector<LogEvent> &timeline() const { return events; }
+
+  void flush()
   {
-    double elapsed = lapse();
-    *timeAgg += elapsed;
-    *stream << tag << ':' << std::setprecision(PRECISION) << elapsed << ',';
+    double prev = origin;
+    for (const LogEvent &e : events)
+    {
+      if (e.tag)
+      {
+        *stream << e.tag << ':';
+      }
+      *stream << std::setprecision(PRECISION) << e.end - prev << ',';
+      prev = e.end;
+    }
+    events.clear();
+    origin = cts;
   }
-};
\ No newline at end of file
+};
@@ -2,25 +2,127 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <string.h>
 #include <mpi.h>
 #include <sys/time.h>
-#include <assert.h>
 #include "sstream"
 #include "logger.h"
+#include "../../common/gemm.h"
+#include "../../common/aligned-matrix.h"
 
-void parseArgs(int argc, char *argv[], int *N)
+// How B reaches the ranks (-m)
+enum BMode
+{
+  B_BCAST,
+  B_RING,
+  B_PIPELINE,
+  B_NODE
+};
+
+// What the timeline is for (-t)
+enum TimingMode
+{
+  TIMING_PROD,
+  TIMING_DIAG
+};
+
+struct Options
+{
+  int N;
+  BMode mode;
+  int panel;
+  TimingMode timing;
+};
+
+void usage(char *prog)
+{
+  fprintf(stderr, "Usage: %s <N> [-m bcast|ring|pipeline|node] [-k panel] [-t prod|diag]\n", prog);
+  fprintf(stderr, "  -m  bcast (default) sends all of B to every rank, ring rotates column panels of B,\n");
+  fprintf(stderr, "      pipeline broadcasts row panels of B and multiplies each as soon as it arrives,\n");
+  fprintf(stderr, "      node broadcasts B to one rank per node and shares it there in memory\n");
+  fprintf(stderr, "  -k  rows of B per panel of the pipeline mode (default: 256)\n");
+  fprintf(stderr, "  -t  prod (default) runs without barriers, diag also syncs the clocks before the run\n");
+  fprintf(stderr, "      and rebuilds idle time and skew from all timelines after it\n");
+}
+
+void parseArgs(int argc, char *argv[], Options *opt)
 {
   char *cp;
   long LN;
+  int c;
+
+  opt->mode = B_BCAST;
+  opt->panel = 256;
+  opt->timing = TIMING_PROD;
+
+  while ((c = getopt(argc, argv, "m:k:t:")) != -1)
+  {
+    switch (c)
+    {
+    case 'm':
+      if (strcmp(optarg, "bcast") == 0)
+      {
+        opt->mode = B_BCAST;
+      }
+      else if (strcmp(optarg, "ring") == 0)
+      {
+        opt->mode = B_RING;
+      }
+      else if (strcmp(optarg, "pipeline") == 0)
+      {
+        opt->mode = B_PIPELINE;
+      }
+      else if (strcmp(optarg, "node") == 0)
+      {
+        opt->mode = B_NODE;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown distribution of B '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'k':
+      opt->panel = atoi(optarg);
+      if (opt->panel < 1)
+      {
+        fprintf(stderr, "[ERROR] Panel size must be positive, found '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    case 't':
+      if (strcmp(optarg, "prod") == 0)
+      {
+        opt->timing = TIMING_PROD;
+      }
+      else if (strcmp(optarg, "diag") == 0)
+      {
+        opt->timing = TIMING_DIAG;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown timing mode '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      exit(1);
+    }
+  }
 
   // Check for the right number of arguments
-  if (argc != 2)
+  if (argc - optind != 1)
   {
-    fprintf(stderr, "[ERROR] Must be run with exactly 1 argument, found %d!\nUsage: %s <N>\n", argc - 1, argv[0]);
+    fprintf(stderr, "[ERROR] Must be run with exactly 1 argument, found %d!\n", argc - optind);
+    usage(argv[0]);
     exit(1);
   }
 
-  cp = argv[1];
+  cp = argv[optind];
   if (*cp == 0)
   {
     fprintf(stderr, "[ERROR] Argument is an empty string\n");
@@ -31,105 +133,697 @@ void parseArgs(int argc, char *argv[], int *N)
 
   if (*cp != 0)
   {
-    fprintf(stderr, "[ERROR] Argument '%s' is not an integer -- '%s'\n", argv[1], cp);
+    fprintf(stderr, "[ERROR] Argument '%s' is not an integer -- '%s'\n", argv[optind], cp);
     exit(1);
   }
 
-  *N = (int)LN;
+  opt->N = (int)LN;
+}
+
+// Balanced split of n items into parts, sizes differ by at most one
+void blockRange(int n, int parts, int idx, int *start, int *count)
+{
+  int q = n / parts;
+  int r = n % parts;
+
+  *count = q + (idx < r ? 1 : 0);
+  *start = idx * q + (idx < r ? idx : r);
 }
 
-int allocMatrix(int ***mat, int rows, int cols)
+// Element counts and offsets of the row slabs of an N x N matrix, one per
+// rank as blockRange splits the rows, for MPI_Scatterv and MPI_Gatherv
+void rowSlabs(int N, int size, int *counts, int *displs)
 {
-  // Allocate rows*cols contiguous items
-  int *p = (int *)malloc(sizeof(int *) * rows * cols);
-  if (!p)
+  int start, rows;
+
+  for (int r = 0; r < size; r++)
   {
-    return -1;
+    blockRange(N, size, r, &start, &rows);
+    counts[r] = rows * N;
+    displs[r] = start * N;
   }
-  // Allocate row pointers
-  *mat = (int **)malloc(rows * sizeof(int *));
-  if (!mat)
+}
+
+// Allocate m or abort, every matrix goes to the collectives as one block
+void allocOrAbort(Matrix<int> *m, int rows, int cols, const char *name)
+{
+  if (m->allocate(rows, cols) != 0)
   {
-    free(p);
-    return -1;
+    fprintf(stderr, "[ERROR] Matrix alloc for %s failed!\n", name);
+    MPI_Abort(MPI_COMM_WORLD, 4);
   }
+}
 
-  // Set up the pointers into the contiguous memory
-  for (int i = 0; i < rows; i++)
+void printMatrix(const Matrix<int> &mat)
+{
+  for (int i = 0; i < mat.rows(); i++)
   {
-    (*mat)[i] = &(p[i * cols]);
+    for (int j = 0; j < mat.cols(); j++)
+    {
+      printf("%6d  ", mat[i][j]);
+    }
+    printf("\n");
   }
-  return 0;
 }
 
-void printMatrix(int ***mat, int rows, int cols)
+// C = A * B for a rows x cols block of A and the cols x cols matrix B, through
+// the packed, register-tiled kernel of gemm.h (B is packed into contiguous
+// strips instead of being walked down its columns)
+void matrixMultiply(const int *A, const int *B, int rows, int cols, int *C)
 {
-  int i, j;
+  if (rows <= 0)
+  {
+    return;
+  }
+
+  memset(C, 0, sizeof(int) * rows * cols);
+  matrixMultiplyAdd(rows, cols, cols, A, cols, B, cols, C, cols);
+}
 
-  for (i = 0; i < rows; i++)
+MPI_Status status;
+
+// Scatter column panel r of the root's N x N matrix B (width and offset from
+// blockRange) to rank r as a contiguous N x width block. The panels are
+// strided in B, so the root sends each through its own vector type
+void scatterPanels(const int *B, int N, int *panel, int rank, int size)
+{
+  int *sendCounts = (int *)calloc(size, sizeof(int));
+  int *sendDispls = (int *)calloc(size, sizeof(int));
+  int *recvCounts = (int *)calloc(size, sizeof(int));
+  int *recvDispls = (int *)calloc(size, sizeof(int));
+  MPI_Datatype *sendTypes = (MPI_Datatype *)calloc(size, sizeof(MPI_Datatype));
+  MPI_Datatype *recvTypes = (MPI_Datatype *)calloc(size, sizeof(MPI_Datatype));
+  int colStart, width;
+
+  for (int r = 0; r < size; r++)
   {
-    for (j = 0; j < cols; j++)
+    sendTypes[r] = MPI_INT;
+    recvTypes[r] = MPI_INT;
+  }
+
+  if (rank == 0)
+  {
+    for (int r = 0; r < size; r++)
     {
-      printf("%6d  ", (*mat)[i][j]);
+      blockRange(N, size, r, &colStart, &width);
+      if (N > 0 && width > 0)
+      {
+        MPI_Type_vector(N, width, N, MPI_INT, &sendTypes[r]);
+        MPI_Type_commit(&sendTypes[r]);
+        sendCounts[r] = 1;
+        sendDispls[r] = colStart * sizeof(int);
+      }
     }
-    printf("\n");
   }
+
+  blockRange(N, size, rank, &colStart, &width);
+  recvCounts[0] = N * width;
+
+  MPI_Alltoallw(B, sendCounts, sendDispls, sendTypes, panel, recvCounts, recvDispls, recvTypes, MPI_COMM_WORLD);
+
+  for (int r = 0; r < size; r++)
+  {
+    if (sendCounts[r] > 0)
+    {
+      MPI_Type_free(&sendTypes[r]);
+    }
+  }
+  free(sendCounts);
+  free(sendDispls);
+  free(recvCounts);
+  free(recvDispls);
+  free(sendTypes);
+  free(recvTypes);
 }
 
-void matrixMultiply(int **A, int **B, int rows, int cols, int ***C)
+// localC (rows x N) = localA * B with B held as column panels rotating in a
+// ring: at step s this rank multiplies panel (rank + s) % size into its
+// columns of localC, then passes it to rank - 1 and takes the next one from
+// rank + 1 (MPI_Sendrecv). panels[0] holds the rank's own panel on entry, and
+// no rank ever holds more than two panels of B
+void ringMultiply(const int *localA, int rows, int N, int rank, int size, int *panels[2], int *localC,
+                  Logger *logger, double *compTime, double *mpiSendrecvTime)
 {
-  int k, i, j, val;
+  int left = (rank + size - 1) % size;
+  int right = (rank + 1) % size;
+  int cur = 0;
 
-  for (k = 0; k < cols; k++)
+  if (rows > 0)
   {
-    for (i = 0; i < rows; i++)
+    memset(localC, 0, sizeof(int) * rows * N);
+  }
+
+  for (int s = 0; s < size; s++)
+  {
+    int p = (rank + s) % size;
+    int colStart, width;
+    blockRange(N, size, p, &colStart, &width);
+
+    if (rows > 0 && width > 0)
     {
-      val = 0;
+      matrixMultiplyAdd(rows, width, N, localA, N, panels[cur], width, localC + colStart, N);
+    }
+    logger->log(compTime, "COMP");
+
+    if (s + 1 < size)
+    {
+      int nextStart, nextWidth;
+      blockRange(N, size, (p + 1) % size, &nextStart, &nextWidth);
+
+      MPI_Sendrecv(panels[cur], N * width, MPI_INT, left, 30,
+                   panels[1 - cur], N * nextWidth, MPI_INT, right, 30, MPI_COMM_WORLD, &status);
+      logger->log(mpiSendrecvTime, "MPI_Sendrecv");
+      cur = 1 - cur;
+    }
+  }
+}
+
+// Row chunks each rank's slab of A and C is cut into in pipeline mode, so the
+// scatter of A and the gather of C proceed chunk by chunk under the multiply
+#define PIPELINE_ROW_CHUNKS 4
+
+// localC = localA * B with every transfer nonblocking. The row chunks of A
+// are scattered (MPI_Iscatterv) and the row panels of B broadcast
+// (MPI_Ibcast) all at once, then each panel adds localA[:, panel] *
+// B[panel, :] into localC as soon as it has arrived, the first one chunk by
+// chunk as the chunks of A come in. After the last panel each chunk of C is
+// complete and its MPI_Igatherv is posted right away. Every rank cuts its
+// rows into the same number of chunks, some of them empty when it has fewer
+// rows than that. The root works on its rows in A and C in place
+void pipelineMultiply(const Options *opt, Matrix<int> &A, Matrix<int> &B, Matrix<int> &C, int *localA, int *localC,
+                      int rank, int size, Logger *logger, double *compTime, double *mpiScatterTime,
+                      double *mpiBcastTime, double *mpiGatherTime)
+{
+  int N = opt->N;
+  int panel = opt->panel < N ? opt->panel : N;
+  int nPanels = panel > 0 ? (N + panel - 1) / panel : 0;
+  int rowStart, rows;
+
+  MPI_Request *bcastReqs = (MPI_Request *)malloc(sizeof(MPI_Request) * (nPanels > 0 ? nPanels : 1));
+  MPI_Request scatterReqs[PIPELINE_ROW_CHUNKS], gatherReqs[PIPELINE_ROW_CHUNKS];
+  int chunkStart[PIPELINE_ROW_CHUNKS], chunkCount[PIPELINE_ROW_CHUNKS];
+
+  // Element counts and offsets of chunk c of every rank, [c * size + r]
+  int *counts = NULL, *displs = NULL;
+
+  blockRange(N, size, rank, &rowStart, &rows);
+  for (int c = 0; c < PIPELINE_ROW_CHUNKS; c++)
+  {
+    blockRange(rows, PIPELINE_ROW_CHUNKS, c, &chunkStart[c], &chunkCount[c]);
+  }
+
+  if (rank == 0)
+  {
+    counts = (int *)malloc(sizeof(int) * PIPELINE_ROW_CHUNKS * size);
+    displs = (int *)malloc(sizeof(int) * PIPELINE_ROW_CHUNKS * size);
+
+    for (int r = 0; r < size; r++)
+    {
+      int start, count, cStart, cCount;
+      blockRange(N, size, r, &start, &count);
+      for (int c = 0; c < PIPELINE_ROW_CHUNKS; c++)
+      {
+        blockRange(count, PIPELINE_ROW_CHUNKS, c, &cStart, &cCount);
+        counts[c * size + r] = cCount * N;
+        displs[c * size + r] = (start + cStart) * N;
+      }
+    }
+  }
+  logger->log(compTime, "COMP");
+
+  for (int c = 0; c < PIPELINE_ROW_CHUNKS; c++)
+  {
+    MPI_Iscatterv(A.data(), counts ? counts + c * size : NULL, displs ? displs + c * size : NULL, MPI_INT,
+                  rank == 0 ? MPI_IN_PLACE : localA + (size_t)chunkStart[c] * N, chunkCount[c] * N, MPI_INT, 0,
+                  MPI_COMM_WORLD, &scatterReqs[c]);
+  }
+  logger->log(mpiScatterTime, "MPI_Iscatterv");
+
+  for (int p = 0; p < nPanels; p++)
+  {
+    int k0 = p * panel;
+    int w = N - k0 < panel ? N - k0 : panel;
+    MPI_Ibcast(B[k0], w * N, MPI_INT, 0, MPI_COMM_WORLD, &bcastReqs[p]);
+  }
+  logger->log(mpiBcastTime, "MPI_Ibcast");
+
+  for (int p = 0; p < nPanels; p++)
+  {
+    int k0 = p * panel;
+    int w = N - k0 < panel ? N - k0 : panel;
+
+    MPI_Wait(&bcastReqs[p], MPI_STATUS_IGNORE);
+    logger->log(mpiBcastTime, "MPI_Wait");
+
+    for (int c = 0; c < PIPELINE_ROW_CHUNKS; c++)
+    {
+      int *a = localA + (size_t)chunkStart[c] * N;
+      int *cc = localC + (size_t)chunkStart[c] * N;
+
+      if (p == 0)
+      {
+        MPI_Wait(&scatterReqs[c], MPI_STATUS_IGNORE);
+        logger->log(mpiScatterTime, "MPI_Wait");
+
+        memset(cc, 0, sizeof(int) * chunkCount[c] * N);
+      }
 
-      for (j = 0; j < cols; j++)
+      if (chunkCount[c] > 0)
       {
-        val += A[i][j] * B[j][k];
+        matrixMultiplyAdd(chunkCount[c], N, w, a + k0, N, B[k0], N, cc, N);
       }
+      logger->log(compTime, "COMP");
 
-      (*C)[i][k] = val;
+      if (p == nPanels - 1)
+      {
+        MPI_Igatherv(rank == 0 ? MPI_IN_PLACE : cc, chunkCount[c] * N, MPI_INT, C.data(),
+                     counts ? counts + c * size : NULL, displs ? displs + c * size : NULL, MPI_INT, 0, MPI_COMM_WORLD,
+                     &gatherReqs[c]);
+        logger->log(mpiGatherTime, "MPI_Igatherv");
+      }
+      else
+      {
+        // Let the panels still in flight progress
+        int done;
+        MPI_Testall(nPanels - p - 1, bcastReqs + p + 1, &done, MPI_STATUSES_IGNORE);
+        logger->log(mpiBcastTime, "MPI_Testall");
+      }
     }
   }
+
+  if (nPanels == 0)
+  {
+    // N == 0: nothing was posted after the scatter, complete it
+    MPI_Waitall(PIPELINE_ROW_CHUNKS, scatterReqs, MPI_STATUSES_IGNORE);
+    logger->log(mpiScatterTime, "MPI_Waitall");
+  }
+  else
+  {
+    MPI_Waitall(PIPELINE_ROW_CHUNKS, gatherReqs, MPI_STATUSES_IGNORE);
+    logger->log(mpiGatherTime, "MPI_Waitall");
+  }
+
+  free(counts);
+  free(displs);
+  free(bcastReqs);
 }
 
-MPI_Status status;
+// Rows covered by the n ranks from position first on, under blockRange
+void rowSlab(int N, int size, int first, int n, int *start, int *rows)
+{
+  int lastStart, lastRows;
+
+  blockRange(N, size, first, start, rows);
+  blockRange(N, size, first + n - 1, &lastStart, &lastRows);
+  *rows = lastStart + lastRows - *start;
+}
+
+// C = A * B with one copy of B per node. The ranks are grouped by node
+// (MPI_COMM_TYPE_SHARED), each node led by its lowest rank, and numbered node
+// by node: every node gets a contiguous slab of rows and each of its ranks a
+// part of it, so row counts still differ by at most one between ranks. Only
+// the leaders talk across nodes. They receive their node's slab of A
+// (MPI_Scatterv) and all of B (MPI_Bcast) straight into a window shared by
+// the node, where every rank reads its rows of A and B and writes its rows
+// of C. The leaders then collect the node slabs of C on rank 0
+// (MPI_Gatherv). Per node that is one copy of B and one slab of A and C,
+// whatever the number of ranks on it
+void nodeMultiply(const Options *opt, Matrix<int> &A, Matrix<int> &B, Matrix<int> &C, int rank, int size,
+                  Logger *logger, double *compTime, double *mpiScatterTime, double *mpiBcastTime,
+                  double *mpiGatherTime)
+{
+  int N = opt->N;
+  MPI_Comm nodeComm, leaderComm;
+  MPI_Win win;
+  MPI_Aint winSize;
+  int dispUnit;
+  int *window;
+  int nodeRank, nodeSize, nodeId, nodeStart, nodeRows, rowStart, rows;
+
+  // Per node (leader order, rank 0 only): element counts and offsets of
+  // its slab
+  int *counts = NULL, *displs = NULL;
+
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+  MPI_Comm_rank(nodeComm, &nodeRank);
+  MPI_Comm_size(nodeComm, &nodeSize);
+  MPI_Comm_split(MPI_COMM_WORLD, nodeRank == 0 ? 0 : MPI_UNDEFINED, rank, &leaderComm);
+
+  // Node of every rank, named by the rank of its leader
+  int *nodeOf = (int *)malloc(sizeof(int) * size);
+  nodeId = rank;
+  MPI_Bcast(&nodeId, 1, MPI_INT, 0, nodeComm);
+  MPI_Allgather(&nodeId, 1, MPI_INT, nodeOf, 1, MPI_INT, MPI_COMM_WORLD);
+
+  // Ranks on nodes with a lower leader come first
+  int first = 0;
+  for (int r = 0; r < size; r++)
+  {
+    first += nodeOf[r] < nodeId ? 1 : 0;
+  }
+  rowSlab(N, size, first, nodeSize, &nodeStart, &nodeRows);
+  blockRange(N, size, first + nodeRank, &rowStart, &rows);
+
+  if (rank == 0)
+  {
+    int nNodes, j = 0;
+    MPI_Comm_size(leaderComm, &nNodes);
+    counts = (int *)malloc(sizeof(int) * nNodes);
+    displs = (int *)malloc(sizeof(int) * nNodes);
+
+    for (int leader = 0; leader < size; leader++)
+    {
+      if (nodeOf[leader] != leader)
+      {
+        continue;
+      }
+
+      int before = 0, n = 0, start, count;
+      for (int r = 0; r < size; r++)
+      {
+        before += nodeOf[r] < leader ? 1 : 0;
+        n += nodeOf[r] == leader ? 1 : 0;
+      }
+      rowSlab(N, size, before, n, &start, &count);
+      counts[j] = count * N;
+      displs[j] = start * N;
+      j++;
+    }
+  }
+  free(nodeOf);
+
+  // B, then the node's slabs of A and C, all in the leader's part
+  size_t count = (size_t)N * N + 2 * (size_t)nodeRows * N;
+  MPI_Win_allocate_shared(nodeRank == 0 ? sizeof(int) * count : 0, sizeof(int), MPI_INFO_NULL, nodeComm, &window,
+                          &win);
+  MPI_Win_shared_query(win, 0, &winSize, &dispUnit, &window);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+
+  int *nodeB = window;
+  int *nodeA = window + (size_t)N * N;
+  int *nodeC = nodeA + (size_t)nodeRows * N;
+  logger->log(mpiBcastTime, "MPI_Win_allocate");
+
+  // Every rank logs the leaders' calls too, so all timelines hold the same
+  // MPI events for the diagnostic mode
+  if (leaderComm != MPI_COMM_NULL)
+  {
+    MPI_Scatterv(A.data(), counts, displs, MPI_INT, nodeA, nodeRows * N, MPI_INT, 0, leaderComm);
+  }
+  logger->log(mpiScatterTime, "MPI_Scatterv");
+
+  if (leaderComm != MPI_COMM_NULL)
+  {
+    if (rank == 0)
+    {
+      memcpy(nodeB, B.data(), sizeof(int) * N * N);
+    }
+    MPI_Bcast(nodeB, N * N, MPI_INT, 0, leaderComm);
+  }
+  logger->log(mpiBcastTime, "MPI_Bcast");
+
+  // The rest of the node reads what the leader received once it is there
+  MPI_Win_sync(win);
+  MPI_Barrier(nodeComm);
+  MPI_Win_sync(win);
+  logger->log(mpiBcastTime, "MPI_Barrier");
+
+  matrixMultiply(nodeA + (size_t)(rowStart - nodeStart) * N, nodeB, rows, N,
+                 nodeC + (size_t)(rowStart - nodeStart) * N);
+  logger->log(compTime, "COMP");
+
+  // and the leader sends C on once every rank of the node wrote its rows
+  MPI_Win_sync(win);
+  MPI_Barrier(nodeComm);
+  MPI_Win_sync(win);
+  logger->log(mpiGatherTime, "MPI_Barrier");
+
+  if (leaderComm != MPI_COMM_NULL)
+  {
+    MPI_Gatherv(nodeC, nodeRows * N, MPI_INT, C.data(), counts, displs, MPI_INT, 0, leaderComm);
+  }
+  logger->log(mpiGatherTime, "MPI_Gatherv");
+
+  MPI_Win_unlock_all(win);
+  MPI_Win_free(&win);
+  if (leaderComm != MPI_COMM_NULL)
+  {
+    MPI_Comm_free(&leaderComm);
+  }
+  MPI_Comm_free(&nodeComm);
+  free(counts);
+  free(displs);
+  logger->log(compTime, "COMP");
+}
+
+// Ping-pong round trips per rank when syncing the clocks
+#define PING_PONG_ROUNDS 16
+
+// Offset of every rank's MPI_Wtime() against rank 0's, known on rank 0 only:
+// offset[r] = clock of r - clock of 0. Rank r stamps each ping it answers,
+// which puts the stamp half way through the round trip on rank 0's clock, up
+// to an error of half the round trip. The round trip with the shortest time
+// is kept, the error goes to error[r]
+void clockOffsets(int rank, int size, double *offset, double *error)
+{
+  double stamp;
+
+  if (rank != 0)
+  {
+    for (int k = 0; k < PING_PONG_ROUNDS; k++)
+    {
+      MPI_Recv(NULL, 0, MPI_DOUBLE, 0, 40, MPI_COMM_WORLD, &status);
+      stamp = MPI_Wtime();
+      MPI_Send(&stamp, 1, MPI_DOUBLE, 0, 41, MPI_COMM_WORLD);
+    }
+    return;
+  }
+
+  offset[0] = error[0] = 0.0;
+  for (int r = 1; r < size; r++)
+  {
+    double best = -1.0;
+
+    for (int k = 0; k < PING_PONG_ROUNDS; k++)
+    {
+      double t0 = MPI_Wtime();
+      MPI_Send(NULL, 0, MPI_DOUBLE, r, 40, MPI_COMM_WORLD);
+      MPI_Recv(&stamp, 1, MPI_DOUBLE, r, 41, MPI_COMM_WORLD, &status);
+      double t1 = MPI_Wtime();
+
+      if (best < 0.0 || t1 - t0 < best)
+      {
+        best = t1 - t0;
+        offset[r] = stamp - 0.5 * (t0 + t1);
+        error[r] = 0.5 * best;
+      }
+    }
+  }
+}
+
+// Skew of one kind of MPI event across the run, summed up on rank 0
+struct EventSkew
+{
+  const char *tag;
+  int count;
+  double max;
+  double sum;
+};
+
+// Calls over all of MPI_COMM_WORLD (or started on every rank together, such
+// as the split and window allocation of the node mode), where a rank can
+// wait for any other. MPI_Sendrecv only waits for the neighbour, and
+// MPI_Wait, MPI_Testall and the node barriers are not global, so their time
+// stays in COMM
+bool isWorldCollective(const char *tag)
+{
+  static const char *const collectives[] = {"MPI_Scatterv", "MPI_Bcast", "MPI_Gatherv", "MPI_Alltoallw",
+                                            "MPI_Iscatterv", "MPI_Ibcast", "MPI_Igatherv", "MPI_Win_allocate"};
+
+  for (const char *c : collectives)
+  {
+    if (tag && strcmp(tag, c) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Idle time and skew rebuilt after the run from the timelines of all ranks,
+// moved onto rank 0's clock with the offsets of clockOffsets(). The
+// collectives are called in the same order everywhere, so the i-th one is
+// the same operation on every rank. Its skew is the spread of the times the
+// ranks entered it, and a rank was idle in it until the last rank entered
+// (never longer than the call itself): what the barriers around each
+// collective used to measure, without them. Every rank gets back its idle
+// time, rank 0 also the span from the first start to the last end
+void rebuildTimeline(const Logger &logger, double startTime, double endTime, const double *offset, int rank,
+                     int size, double *idleTime, double *sysTime)
+{
+  const std::vector<LogEvent> &events = logger.timeline();
+  std::vector<double> mine;
+  std::vector<double> all;
+  int n, minN, maxN;
+
+  // start and end of the run, then enter and exit of every collective
+  mine.push_back(startTime);
+  mine.push_back(endTime);
+  for (size_t e = 0; e < events.size(); e++)
+  {
+    if (isWorldCollective(events[e].tag))
+    {
+      mine.push_back(e > 0 ? events[e - 1].end : logger.start());
+      mine.push_back(events[e].end);
+    }
+  }
+
+  n = (int)mine.size();
+  MPI_Allreduce(&n, &minN, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  MPI_Allreduce(&n, &maxN, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  if (minN != maxN)
+  {
+    if (rank == 0)
+    {
+      fprintf(stderr, "[WARN] Ranks logged different collectives (%d to %d), no idle time rebuilt\n", minN / 2 - 1,
+              maxN / 2 - 1);
+    }
+    return;
+  }
+
+  if (rank == 0)
+  {
+    all.resize((size_t)n * size);
+  }
+  MPI_Gather(mine.data(), n, MPI_DOUBLE, all.data(), n, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+  std::vector<double> idle(rank == 0 ? size : 1, 0.0);
+
+  if (rank == 0)
+  {
+    std::vector<EventSkew> skews;
+    double first = 0.0, last = 0.0;
+
+    for (int r = 0; r < size; r++)
+    {
+      for (int v = 0; v < n; v++)
+      {
+        all[(size_t)r * n + v] -= offset[r];
+      }
+      if (r == 0 || all[(size_t)r * n] < first)
+      {
+        first = all[(size_t)r * n];
+      }
+      if (r == 0 || all[(size_t)r * n + 1] > last)
+      {
+        last = all[(size_t)r * n + 1];
+      }
+    }
+    *sysTime = last - first;
+
+    int i = 0;
+    for (size_t e = 0; e < events.size(); e++)
+    {
+      if (!isWorldCollective(events[e].tag))
+      {
+        continue;
+      }
+
+      int v = 2 + 2 * i++;
+      double minEnter = all[v], maxEnter = all[v];
+      for (int r = 1; r < size; r++)
+      {
+        double enter = all[(size_t)r * n + v];
+        minEnter = enter < minEnter ? enter : minEnter;
+        maxEnter = enter > maxEnter ? enter : maxEnter;
+      }
+
+      for (int r = 0; r < size; r++)
+      {
+        double enter = all[(size_t)r * n + v];
+        double exit = all[(size_t)r * n + v + 1];
+        double wait = maxEnter - enter;
+        idle[r] += wait < exit - enter ? wait : exit - enter;
+      }
+
+      size_t k = 0;
+      while (k < skews.size() && strcmp(skews[k].tag, events[e].tag) != 0)
+      {
+        k++;
+      }
+      if (k == skews.size())
+      {
+        skews.push_back({events[e].tag, 0, 0.0, 0.0});
+      }
+      skews[k].count++;
+      skews[k].sum += maxEnter - minEnter;
+      if (maxEnter - minEnter > skews[k].max)
+      {
+        skews[k].max = maxEnter - minEnter;
+      }
+    }
+
+    for (const EventSkew &k : skews)
+    {
+      fprintf(stdout, "%2d: [INFO] Skew %-13s max: %.6f, mean: %.6f, calls: %d\n", rank, k.tag, k.max,
+              k.sum / k.count, k.count);
+    }
+  }
+
+  MPI_Scatter(idle.data(), 1, MPI_DOUBLE, idleTime, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+}
 
 int main(int argc, char *argv[])
 {
-  int rank, size, N, i, j, k, dest, source;
+  int rank, size, N, i, j;
+  Options opt;
 
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-  parseArgs(argc, argv, &N);
+  parseArgs(argc, argv, &opt);
+  N = opt.N;
 
-  int rowsPerTask = N / size;
-  int rowOffset = rowsPerTask;
+  // Rows of this rank, counts differ by at most one between ranks
+  int rowStart, rows;
+  blockRange(N, size, rank, &rowStart, &rows);
 
-  double mpiScatterTime = 0.0, mpiBcastTime = 0.0, mpiGatherTime = 0.0, compTime = 0.0, idleTime = 0.0;
+  double mpiScatterTime = 0.0, mpiBcastTime = 0.0, mpiGatherTime = 0.0, mpiSendrecvTime = 0.0, compTime = 0.0,
+         idleTime = 0.0, syncTime = 0.0;
   std::stringstream tl;
 
   tl << std::setw(2) << rank << ": [INFO] Timeline: ";
 
   Logger logger(&tl);
 
-  int **A = NULL, **B = NULL, **C = NULL, **localA = NULL, **localC = NULL;
-
-  allocMatrix(&A, N, N);
-  assert(A != NULL);
-
-  allocMatrix(&B, N, N);
-  assert(B != NULL);
+  // Only the root holds the global matrices, every other rank keeps O(N^2/p)
+  // in ring mode (its rows of A and C plus two panels of B). The root's own
+  // rows stay in A and C (MPI_IN_PLACE), so it has no local copies
+  Matrix<int> A, B, C, localA, localC;
+  Matrix<int> panels[2];
+  int *myA, *myC;
+  std::vector<int> counts, displs;
 
   if (rank == 0)
   {
+    allocOrAbort(&A, N, N, "A");
+    allocOrAbort(&B, N, N, "B");
 
     fprintf(stdout, "%2d: [INFO] N: %d, NP: %d\n", rank, N, size);
+    fprintf(stdout, "%2d: [INFO] Kernel: %s\n", rank, gemmIsaName(gemmIsa()));
+    if (opt.mode == B_RING)
+    {
+      fprintf(stdout, "%2d: [INFO] B rotated in a ring of column panels\n", rank);
+    }
+    else if (opt.mode == B_PIPELINE)
+    {
+      fprintf(stdout, "%2d: [INFO] B broadcast in row panels of %d rows, pipelined\n", rank, opt.panel);
+    }
+    else if (opt.mode == B_NODE)
+    {
+      fprintf(stdout, "%2d: [INFO] B broadcast among node leaders, one shared copy per node\n", rank);
+    }
 
     for (i = 0; i < N; i++)
     {
@@ -141,101 +835,178 @@ int main(int argc, char *argv[])
     }
 
     // fprintf(stdout, "%2d: [INFO] Matrix A\n", rank);
-    // printMatrix(&A, N, N);
+    // printMatrix(A);
 
     // fprintf(stdout, "%2d: [INFO] Matrix B\n", rank);
-    // printMatrix(&B, N, N);
+    // printMatrix(B);
   }
   logger.log(&compTime, "COMP");
 
-  MPI_Barrier(MPI_COMM_WORLD);
+  // No barrier from here to the end of the run: every rank enters the
+  // collectives as it would in production, and what it waits there for
+  // slower ranks is part of its COMM time. The diagnostic mode separates that
+  // wait afterwards, from timestamps on a common clock
+  std::vector<double> offset(rank == 0 ? size : 1), offsetError(rank == 0 ? size : 1);
+
+  if (opt.timing == TIMING_DIAG)
+  {
+    clockOffsets(rank, size, offset.data(), offsetError.data());
+
+    for (int r = 1; rank == 0 && r < size; r++)
+    {
+      fprintf(stdout, "%2d: [INFO] Clock offset of %2d: %+.9f, error: %.9f\n", rank, r, offset[r], offsetError[r]);
+    }
+
+    // Rank 0 syncs the ranks one after the other, so without this the early
+    // ones would start the run first and show the stagger as idle time
+    MPI_Barrier(MPI_COMM_WORLD);
+    logger.log(&syncTime, "SYNC");
+  }
+
   // totalTime -= MPI_Wtime();
-  logger.log(&idleTime, "IDLE");
+  double startTime = MPI_Wtime();
 
-  allocMatrix(&localA, rowsPerTask, N);
-  assert(localA != NULL);
-  logger.log(&compTime, "COMP");
+  if (rank == 0)
+  {
+    allocOrAbort(&C, N, N, "C");
+    myA = A.data();
+    myC = C.data();
 
-  // Scatter
-  MPI_Barrier(MPI_COMM_WORLD);
-  // mpiScatterTime -= MPI_Wtime();
-  logger.log(&idleTime, "IDLE");
+    counts.resize(size);
+    displs.resize(size);
+    rowSlabs(N, size, counts.data(), displs.data());
+  }
+  else if (opt.mode == B_NODE)
+  {
+    // Rows of A and C are read and written in the node's shared window
+    myA = myC = NULL;
+  }
+  else
+  {
+    allocOrAbort(&localA, rows, N, "localA");
+    allocOrAbort(&localC, rows, N, "localC");
+    myA = localA.data();
+    myC = localC.data();
+  }
 
-  MPI_Scatter(&(A[0][0]), rowsPerTask * N, MPI_INT, &(localA[0][0]), rowsPerTask * N, MPI_INT, 0, MPI_COMM_WORLD);
-  logger.log(&mpiScatterTime, "MPI_Scatter");
+  if (opt.mode == B_NODE)
+  {
+    logger.log(&compTime, "COMP");
 
-  MPI_Barrier(MPI_COMM_WORLD);
-  // mpiScatterTime += MPI_Wtime();
-  logger.log(&idleTime, "IDLE");
+    nodeMultiply(&opt, A, B, C, rank, size, &logger, &compTime, &mpiScatterTime, &mpiBcastTime, &mpiGatherTime);
+  }
+  else if (opt.mode == B_PIPELINE)
+  {
+    if (rank != 0)
+    {
+      allocOrAbort(&B, N, N, "B");
+    }
+    logger.log(&compTime, "COMP");
 
-  // Bcast
-  MPI_Barrier(MPI_COMM_WORLD);
-  // mpiBcastTime -= MPI_Wtime();
-  logger.log(&idleTime, "IDLE");
+    pipelineMultiply(&opt, A, B, C, myA, myC, rank, size, &logger, &compTime, &mpiScatterTime, &mpiBcastTime,
+                     &mpiGatherTime);
+  }
+  else
+  {
+    logger.log(&compTime, "COMP");
 
-  MPI_Bcast(&(B[0][0]), N * N, MPI_INT, 0, MPI_COMM_WORLD);
-  logger.log(&mpiBcastTime, "MPI_Bcast");
+    // Scatter
+    // mpiScatterTime -= MPI_Wtime();
+    MPI_Scatterv(A.data(), counts.data(), displs.data(), MPI_INT, rank == 0 ? MPI_IN_PLACE : myA, rows * N,
+                 MPI_INT, 0, MPI_COMM_WORLD);
+    logger.log(&mpiScatterTime, "MPI_Scatterv");
+    // mpiScatterTime += MPI_Wtime();
 
-  MPI_Barrier(MPI_COMM_WORLD);
-  // mpiBcastTime += MPI_Wtime();
-  logger.log(&idleTime, "IDLE");
+    if (opt.mode == B_RING)
+    {
+      allocOrAbort(&panels[0], N, (N + size - 1) / size, "panel");
+      allocOrAbort(&panels[1], N, (N + size - 1) / size, "panel");
+      logger.log(&compTime, "COMP");
 
-  allocMatrix(&localC, rowsPerTask, N);
-  assert(localC != NULL);
+      // Scatter of the column panels of B
+      scatterPanels(B.data(), N, panels[0].data(), rank, size);
+      logger.log(&mpiScatterTime, "MPI_Alltoallw");
 
-  // compTime -= MPI_Wtime();
-  matrixMultiply(localA, B, rowsPerTask, N, &localC);
-  // compTime += MPI_Wtime();
+      int *panelPtrs[2] = {panels[0].data(), panels[1].data()};
+      ringMultiply(myA, rows, N, rank, size, panelPtrs, myC, &logger, &compTime, &mpiSendrecvTime);
+    }
+    else
+    {
+      if (rank != 0)
+      {
+        allocOrAbort(&B, N, N, "B");
+      }
+      logger.log(&compTime, "COMP");
 
-  allocMatrix(&C, N, N);
-  assert(C != NULL);
-  logger.log(&compTime, "COMP");
+      // Bcast
+      // mpiBcastTime -= MPI_Wtime();
+      MPI_Bcast(B.data(), N * N, MPI_INT, 0, MPI_COMM_WORLD);
+      logger.log(&mpiBcastTime, "MPI_Bcast");
+      // mpiBcastTime += MPI_Wtime();
 
-  // Gather
-  MPI_Barrier(MPI_COMM_WORLD);
-  logger.log(&idleTime, "IDLE");
-  // mpiGatherTime -= MPI_Wtime();
+      // compTime -= MPI_Wtime();
+      matrixMultiply(myA, B.data(), rows, N, myC);
+      // compTime += MPI_Wtime();
+    }
 
-  MPI_Gather(&(localC[0][0]), rowsPerTask * N, MPI_INT, &C[0][0], rowsPerTask * N, MPI_INT, 0, MPI_COMM_WORLD);
-  logger.log(&mpiGatherTime, "MPI_Gather");
+    logger.log(&compTime, "COMP");
 
-  MPI_Barrier(MPI_COMM_WORLD);
-  logger.log(&idleTime, "IDLE");
-  // mpiGatherTime += MPI_Wtime();
+    // Gather
+    // mpiGatherTime -= MPI_Wtime();
+    MPI_Gatherv(rank == 0 ? MPI_IN_PLACE : myC, rows * N, MPI_INT, C.data(), counts.data(), displs.data(), MPI_INT, 0,
+                MPI_COMM_WORLD);
+    logger.log(&mpiGatherTime, "MPI_Gatherv");
+    // mpiGatherTime += MPI_Wtime();
+  }
 
-  MPI_Barrier(MPI_COMM_WORLD);
-  logger.log(&idleTime, "IDLE");
   // totalTime += MPI_Wtime();
+  double endTime = MPI_Wtime();
+  double sysTime = endTime - startTime;
 
   // if (rank == 0)
   // {
   //   // Print result
   //   fprintf(stdout, "%2d: [INFO] Matrix result\n", rank);
-  //   printMatrix(&C, N, N);
+  //   printMatrix(C);
   // }
 
-  free(A);
-  free(B);
-  free(C);
-  free(localA);
-  free(localC);
+  A.release();
+  B.release();
+  C.release();
+  localA.release();
+  localC.release();
+  panels[0].release();
+  panels[1].release();
   logger.log(&compTime, "COMP");
 
-  MPI_Barrier(MPI_COMM_WORLD);
-  logger.log(&idleTime, "IDLE");
+  if (opt.timing == TIMING_DIAG)
+  {
+    rebuildTimeline(logger, startTime, endTime, offset.data(), rank, size, &idleTime, &sysTime);
+  }
 
   MPI_Finalize();
 
-  double commTime = mpiScatterTime + mpiBcastTime + mpiGatherTime;
+  // The idle time rebuilt in diagnostic mode was spent inside the MPI calls
+  double commTime = mpiScatterTime + mpiBcastTime + mpiGatherTime + mpiSendrecvTime - idleTime;
   double totalTime = commTime + compTime + idleTime;
 
   fprintf(stdout, "%2d: [INFO] Sctr. time: %.6f\n", rank, mpiScatterTime);
   fprintf(stdout, "%2d: [INFO] Bcst. time: %.6f\n", rank, mpiBcastTime);
+  fprintf(stdout, "%2d: [INFO] SndR. time: %.6f\n", rank, mpiSendrecvTime);
   fprintf(stdout, "%2d: [INFO] Gthr. time: %.6f\n", rank, mpiGatherTime);
   fprintf(stdout, "%2d: [INFO] COMM. TIME: %.6f\n", rank, commTime);
   fprintf(stdout, "%2d: [INFO] COMP. TIME: %.6f\n", rank, compTime);
   fprintf(stdout, "%2d: [INFO] TOTAL TIME: %.6f\n", rank, totalTime);
-  fprintf(stdout, "%2d: [INFO] IDLE  TIME: %.6f\n", rank, idleTime);
+  if (opt.timing == TIMING_DIAG)
+  {
+    fprintf(stdout, "%2d: [INFO] IDLE  TIME: %.6f\n", rank, idleTime);
+  }
+  if (rank == 0)
+  {
+    fprintf(stdout, "%2d: [INFO] Sys time: %.6f\n", rank, sysTime);
+    fprintf(stdout, "%2d: [INFO] GFLOP/s: %.3f\n", rank, 2.0 * N * N * N / sysTime * 1e-9);
+  }
+  logger.flush();
   std::cout << tl.str() << std::endl;
 
   return 0;
@@ -6,11 +6,18 @@ mkdir -p ${PWD}/{out,run,logs}
 # Src file name
 SRC_FILE="${PWD}/src/matmul-mm.cpp"
 
+# Extra program arguments passed through from the command line, e.g. "-m dynamic"
+ARGS="$*"
+
+# Log and run file name suffix for ARGS, e.g. "-m dynamic" yields "-m-dynamic"
+SUFFIX=$(echo "$ARGS" | sed -e "s|^ *||" -e "s| *$||" -e "s| \+|-|g")
+SUFFIX=${SUFFIX:+-${SUFFIX}}
+
 # Compiled file name
 O_FILE="${PWD}/out/matmul-mm.o"
 
 # Compile SRC_FILE and output it to O_FILE
-mpic++ $SRC_FILE -o $O_FILE
+mpic++ -O3 $SRC_FILE -o $O_FILE
 
 # Loop through N matrix dimensions
 for N in 256 512 1024 2048 4096
@@ -26,10 +33,10 @@ do
     printf -v PADDED_NP "%02d" $NP
 
     # Log file name
-    LOG_FILE="${PWD}/logs/matmul-mm-multi-nodes-n${PADDED_N}-np${PADDED_NP}.out"
+    LOG_FILE="${PWD}/logs/matmul-mm-multi-nodes-n${PADDED_N}-np${PADDED_NP}${SUFFIX}.out"
 
     # Run filename
-    RUN_FILE="${PWD}/run/matmul-mm-multi-nodes-n${PADDED_N}-np${PADDED_NP}.sh"
+    RUN_FILE="${PWD}/run/matmul-mm-multi-nodes-n${PADDED_N}-np${PADDED_NP}${SUFFIX}.sh"
 
     # Number of nodes required for corresponding NP
     N_NODES=$(((NP - 1) / 8 + 1))
@@ -99,6 +106,7 @@ do
     sed -i "s|__NUM_PROCESSORS__|${NP}|" $RUN_FILE
     sed -i "s|__O_FILE__|${O_FILE}|" $RUN_FILE
     sed -i "s|__MATRIX_N__|${N}|" $RUN_FILE
+    sed -i "s|__ARGS__|${ARGS}|" $RUN_FILE
 
     # Add execute permission to RUN_FILE
     chmod +x $RUN_FILE
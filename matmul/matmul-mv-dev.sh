@@ -6,11 +6,18 @@ mkdir -p ${PWD}/{out,run,logs}
 # Src file name
 SRC_FILE="${PWD}/src/matmul-mv.cpp"
 
+# Extra program arguments passed through from the command line
+ARGS="$*"
+
+# Log and run file name suffix for ARGS, spaces replaced by "-"
+SUFFIX=$(echo "$ARGS" | sed -e "s|^ *||" -e "s| *$||" -e "s| \+|-|g")
+SUFFIX=${SUFFIX:+-${SUFFIX}}
+
 # Compiled file name
 O_FILE="${PWD}/out/matmul-mv.o"
 
 # Compile SRC_FILE and output it to O_FILE
-mpic++ $SRC_FILE -o $O_FILE
+mpic++ -O3 $SRC_FILE -o $O_FILE
 
 # Loop through N matrix dimensions
 for N in 256 512 1024 2048 4096
@@ -26,7 +33,7 @@ do
     printf -v PADDED_NP "%02d" $NP
 
     # Task name
-    TASK="matmul-mv-dev-n${PADDED_N}-np${PADDED_NP}"
+    TASK="matmul-mv-dev-n${PADDED_N}-np${PADDED_NP}${SUFFIX}"
 
     # Log file name
     LOG_FILE="${PWD}/logs/${TASK}.out"
@@ -36,7 +43,7 @@ do
     # then Open MPI will attempt to discover the number of hardware threads on the node,
     # and use that as the number of slots available. 
     echo "🏃 ${TASK}..."
-    mpirun --use-hwthread-cpus -np $NP $O_FILE $N | tee $LOG_FILE
+    mpirun --use-hwthread-cpus -np $NP $O_FILE $N $ARGS | tee $LOG_FILE
     echo "✅ ${TASK}"
   done
 done
@@ -6,11 +6,18 @@ mkdir -p ${PWD}/{out,run,logs}
 # Src file name
 SRC_FILE="${PWD}/src/matmul-mv.cpp"
 
+# Extra program arguments passed through from the command line
+ARGS="$*"
+
+# Log and run file name suffix for ARGS, spaces replaced by "-"
+SUFFIX=$(echo "$ARGS" | sed -e "s|^ *||" -e "s| *$||" -e "s| \+|-|g")
+SUFFIX=${SUFFIX:+-${SUFFIX}}
+
 # Compiled file name
 O_FILE="${PWD}/out/matmul-mv.o"
 
 # Compile SRC_FILE and output it to O_FILE
-mpic++ $SRC_FILE -o $O_FILE
+mpic++ -O3 $SRC_FILE -o $O_FILE
 
 # Loop through N matrix dimensions
 for N in 256 512 1024 2048 4096
@@ -26,7 +33,7 @@ do
     printf -v PADDED_NP "%02d" $NP
 
     # Log file name
-    LOG_FILE="${PWD}/logs/matmul-mv-single-node-n${PADDED_N}-np${PADDED_NP}.out"
+    LOG_FILE="${PWD}/logs/matmul-mv-single-node-n${PADDED_N}-np${PADDED_NP}${SUFFIX}.out"
 
     # Host file name
     HOST_FILE="${PWD}/run/hostfile"
@@ -35,6 +42,6 @@ do
     cp ${PWD}/templates/template-hostfile $HOST_FILE
 
     # Run O_FILE the corresponding configurations
-    mpirun --hostfile $HOST_FILE -np $NP $O_FILE $N > $LOG_FILE
+    mpirun --hostfile $HOST_FILE -np $NP $O_FILE $N $ARGS > $LOG_FILE
   done
 done
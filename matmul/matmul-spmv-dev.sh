@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# Create required directories
+mkdir -p ${PWD}/{out,run,logs}
+
+# Src file name
+SRC_FILE="${PWD}/src/matmul-spmv.cpp"
+
+# Matrix Market file, the first argument
+MTX_FILE=$(realpath "$1")
+shift
+
+# Matrix name for log and run file name
+MTX_NAME=$(basename "$MTX_FILE" .mtx)
+
+# Extra program arguments passed through from the command line
+ARGS="$*"
+
+# Log and run file name suffix for ARGS, spaces replaced by "-"
+SUFFIX=$(echo "$ARGS" | sed -e "s|^ *||" -e "s| *$||" -e "s| \+|-|g")
+SUFFIX=${SUFFIX:+-${SUFFIX}}
+
+# Compiled file name
+O_FILE="${PWD}/out/matmul-spmv.o"
+
+# Compile SRC_FILE and output it to O_FILE
+mpic++ -O3 $SRC_FILE -o $O_FILE
+
+# Loop through NP number of processors
+for NP in 1 2 4 8
+do
+  # Create padded NP (2 digits) for log and run file name
+  # Example:
+  #   NP = 1 yields PADDED_NP = 01
+  printf -v PADDED_NP "%02d" $NP
+
+  # Task name
+  TASK="matmul-spmv-dev-${MTX_NAME}-np${PADDED_NP}${SUFFIX}"
+
+  # Log file name
+  LOG_FILE="${PWD}/logs/${TASK}.out"
+
+  # Run O_FILE the corresponding configurations
+  # If --use-hwthread-cpus is specified on the mpirun command line,
+  # then Open MPI will attempt to discover the number of hardware threads on the node,
+  # and use that as the number of slots available. 
+  echo "🏃 ${TASK}..."
+  mpirun --use-hwthread-cpus -np $NP $O_FILE $MTX_FILE $ARGS | tee $LOG_FILE
+  echo "✅ ${TASK}"
+done
@@ -0,0 +1,118 @@
+#!/bin/bash
+
+# Create required directories
+mkdir -p ${PWD}/{out,run,logs}
+
+# Src file name
+SRC_FILE="${PWD}/src/matmul-spmv.cpp"
+
+# Matrix Market file, the first argument
+MTX_FILE=$(realpath "$1")
+shift
+
+# Matrix name for log and run file name
+MTX_NAME=$(basename "$MTX_FILE" .mtx)
+
+# Extra program arguments passed through from the command line
+ARGS="$*"
+
+# Log and run file name suffix for ARGS, spaces replaced by "-"
+SUFFIX=$(echo "$ARGS" | sed -e "s|^ *||" -e "s| *$||" -e "s| \+|-|g")
+SUFFIX=${SUFFIX:+-${SUFFIX}}
+
+# Compiled file name
+O_FILE="${PWD}/out/matmul-spmv.o"
+
+# Compile SRC_FILE and output it to O_FILE
+mpic++ -O3 $SRC_FILE -o $O_FILE
+
+# Loop through NP number of processors
+for NP in 1 2 4 8 16 32 64
+do
+  # Create padded NP (2 digits) for log and run file name
+  # Example:
+  #   NP = 1 yields PADDED_NP = 01
+  printf -v PADDED_NP "%02d" $NP
+
+  # Log file name
+  LOG_FILE="${PWD}/logs/matmul-spmv-multi-nodes-${MTX_NAME}-np${PADDED_NP}${SUFFIX}.out"
+
+  # Run filename
+  RUN_FILE="${PWD}/run/matmul-spmv-multi-nodes-${MTX_NAME}-np${PADDED_NP}${SUFFIX}.sh"
+
+  # Number of nodes required for corresponding NP
+  N_NODES=$(((NP - 1) / 8 + 1))
+
+  # Identify currently idle node(s) to be used
+  IDLE_NODES=$(sinfo-1 -t I -o %n -h)
+
+  # Count of idle node(s)
+  IDLE_NODES_CNT=$(echo $IDLE_NODES | grep -o "\n" | wc -l)
+
+  # Populate the nodes
+  NODE_LIST=""
+
+  # Added node list count
+  NODE_LIST_CNT=0
+
+  # Loop through node names
+  for NODE in $(seq -f "node-%02g" 1 8)
+  do
+    # Check if idle nodes count is sufficient to run the configuration
+    if [[ $IDLE_NODES_CNT -lt $N_NODES ]];
+    then
+      # The currently idle nodes count is insufficient, fallback to sequential node assignment
+      if [[ $NODE == "node-01" ]];
+      then
+        echo "[WARN] Insufficient Idle Node(s). Requested: $N_NODES, Idle: $IDLE_NODES_CNT, Using sequential nodes assignment for $RUN_FILE"
+      fi
+
+      # Add NODE to the NODE_LIST
+      NODE_LIST="${NODE_LIST},${NODE}"
+
+      # Increment node list count
+      NODE_LIST_CNT=$((NODE_LIST_CNT + 1))
+    else
+      # The currently idle nodes count is sufficient
+      if [[ $NODE == "node-01" ]];
+      then
+        echo "[INFO] Using idle nodes assignment for $RUN_FILE"
+      fi
+
+       # Check if the current NODE is IDLE
+      if [[ $IDLE_NODES == *"$NODE"* ]];
+      then
+        # NODE is IDLE, so add it to the NODE_LIST
+        NODE_LIST="${NODE_LIST},${NODE}"
+
+        # Increment node list count
+        NODE_LIST_CNT=$((NODE_LIST_CNT + 1))
+      fi
+    fi
+
+    # Check if NODE_LIST_CNT already satisfies N_NODES
+    if [[ $NODE_LIST_CNT -eq $N_NODES ]];
+    then
+      # Break the loop
+      break
+    fi
+  done
+
+  # Trim leading "," from previous loop (if any)
+  NODE_LIST=$(echo $NODE_LIST | sed "s|^,||g")
+
+  # Generate RUN_FILE by replacing some placeholders in the template file
+  sed "s|__LOG_NAME__|${LOG_FILE}|" ${PWD}/templates/template-matmul.sh > $RUN_FILE
+  sed -i "s|__NUM_NODES__|${N_NODES}|" $RUN_FILE
+  sed -i "s|__NODE_LIST__|${NODE_LIST}|" $RUN_FILE
+  sed -i "s|__NUM_PROCESSORS__|${NP}|" $RUN_FILE
+  sed -i "s|__O_FILE__|${O_FILE}|" $RUN_FILE
+  sed -i "s|__MATRIX_N__|${MTX_FILE}|" $RUN_FILE
+  sed -i "s|__ARGS__|${ARGS}|" $RUN_FILE
+
+  # Add execute permission to RUN_FILE
+  chmod +x $RUN_FILE
+
+  # Add RUN_FILE to slurm queue
+  sbatch $RUN_FILE
+done
@@ -0,0 +1,48 @@
+#!/bin/bash
+
+# Create required directories
+mkdir -p ${PWD}/{out,run,logs}
+
+# Src file name
+SRC_FILE="${PWD}/src/matmul-spmv.cpp"
+
+# Matrix Market file, the first argument
+MTX_FILE=$(realpath "$1")
+shift
+
+# Matrix name for log and run file name
+MTX_NAME=$(basename "$MTX_FILE" .mtx)
+
+# Extra program arguments passed through from the command line
+ARGS="$*"
+
+# Log and run file name suffix for ARGS, spaces replaced by "-"
+SUFFIX=$(echo "$ARGS" | sed -e "s|^ *||" -e "s| *$||" -e "s| \+|-|g")
+SUFFIX=${SUFFIX:+-${SUFFIX}}
+
+# Compiled file name
+O_FILE="${PWD}/out/matmul-spmv.o"
+
+# Compile SRC_FILE and output it to O_FILE
+mpic++ -O3 $SRC_FILE -o $O_FILE
+
+# Loop through NP number of processors
+for NP in 1 2 4 8 16 32 64
+do
+  # Create padded NP (2 digits) for log and run file name
+  # Example:
+  #   NP = 1 yields PADDED_NP = 01
+  printf -v PADDED_NP "%02d" $NP
+
+  # Log file name
+  LOG_FILE="${PWD}/logs/matmul-spmv-single-node-${MTX_NAME}-np${PADDED_NP}${SUFFIX}.out"
+
+  # Host file name
+  HOST_FILE="${PWD}/run/hostfile"
+
+  # Generate HOST_FILE by copying template-hostfile
+  cp ${PWD}/templates/template-hostfile $HOST_FILE
+
+  # Run O_FILE the corresponding configurations
+  mpirun --hostfile $HOST_FILE -np $NP $O_FILE $MTX_FILE $ARGS > $LOG_FILE
+done
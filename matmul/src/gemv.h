@@ -0,0 +1,141 @@
+#ifndef GEMV_H
+#define GEMV_H
+
+// Matrix-vector kernel computing y += A * x on a row-major block.
+//
+// GEMV reads every element of A exactly once, so it is bound by memory
+// bandwidth rather than arithmetic. The kernel walks GEMV_MR rows of A side
+// by side, each with its own pair of vector accumulators, so one load of x
+// feeds GEMV_MR multiply-adds and the accumulators carry no dependency on
+// each other. A is not reused, so it is prefetched GEMV_PREFETCH bytes ahead
+// with a low-locality hint (prefetcht2; prefetchnta measured about half the
+// bandwidth), while x is reused by every row group and stays in cache.
+//
+// Uses the vector types and the runtime ISA selection of gemm.h.
+
+#include "../../common/gemm.h"
+
+// Rows of A processed together
+#define GEMV_MR 4
+
+// Prefetch distance into each row of A (bytes)
+#define GEMV_PREFETCH 512
+
+// y[0..R) += A[0..R) * x for R rows of length n
+template <typename T, int VB, int R>
+GEMM_INLINE void gemvRows(int n, const T *A, int lda, const T *x, T *y)
+{
+  typedef typename GemmVec<T, VB>::type V;
+  const int W = VB / sizeof(T);
+
+  V acc[R][2];
+  for (int r = 0; r < R; r++)
+  {
+    acc[r][0] = (V){};
+    acc[r][1] = (V){};
+  }
+
+  int j = 0;
+  for (; j + 2 * W <= n; j += 2 * W)
+  {
+    V x0, x1;
+    memcpy(&x0, x + j, VB);
+    memcpy(&x1, x + j + W, VB);
+
+#pragma GCC unroll 4
+    for (int r = 0; r < R; r++)
+    {
+      const T *a = A + (size_t)r * lda + j;
+      __builtin_prefetch((const char *)a + GEMV_PREFETCH, 0, 1);
+      if (2 * VB > 64)
+      {
+        __builtin_prefetch((const char *)a + GEMV_PREFETCH + 64, 0, 1);
+      }
+
+      V a0, a1;
+      memcpy(&a0, a, VB);
+      memcpy(&a1, a + W, VB);
+      acc[r][0] += a0 * x0;
+      acc[r][1] += a1 * x1;
+    }
+  }
+
+  for (int r = 0; r < R; r++)
+  {
+    T lanes[W];
+    V sum = acc[r][0] + acc[r][1];
+    memcpy(lanes, &sum, VB);
+
+    T s = 0;
+    for (int l = 0; l < W; l++)
+    {
+      s += lanes[l];
+    }
+    for (int jj = j; jj < n; jj++)
+    {
+      s += A[(size_t)r * lda + jj] * x[jj];
+    }
+    y[r] += s;
+  }
+}
+
+template <typename T, int VB>
+GEMM_INLINE void gemvBlocked(int m, int n, const T *A, int lda, const T *x, T *y)
+{
+  int i = 0;
+  for (; i + GEMV_MR <= m; i += GEMV_MR)
+  {
+    gemvRows<T, VB, GEMV_MR>(n, A + (size_t)i * lda, lda, x, y + i);
+  }
+  for (; i < m; i++)
+  {
+    gemvRows<T, VB, 1>(n, A + (size_t)i * lda, lda, x, y + i);
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+template <typename T>
+__attribute__((target("avx512f,avx512dq"))) void gemvAvx512(int m, int n, const T *A, int lda, const T *x, T *y)
+{
+  gemvBlocked<T, 64>(m, n, A, lda, x, y);
+}
+
+template <typename T>
+__attribute__((target("avx2,fma"))) void gemvAvx2(int m, int n, const T *A, int lda, const T *x, T *y)
+{
+  gemvBlocked<T, 32>(m, n, A, lda, x, y);
+}
+#endif
+
+template <typename T>
+void gemvGeneric(int m, int n, const T *A, int lda, const T *x, T *y)
+{
+  gemvBlocked<T, 16>(m, n, A, lda, x, y);
+}
+
+// y (m) += A (m x n) * x (n)
+template <typename T>
+void matrixVectorMultiplyAdd(int m, int n, const T *A, int lda, const T *x, T *y)
+{
+  if (m <= 0 || n <= 0)
+  {
+    return;
+  }
+
+  switch (gemmIsa())
+  {
+#if defined(__x86_64__) || defined(__i386__)
+  case GEMM_AVX512:
+    gemvAvx512<T>(m, n, A, lda, x, y);
+    break;
+  case GEMM_AVX2:
+    gemvAvx2<T>(m, n, A, lda, x, y);
+    break;
+#endif
+  default:
+    gemvGeneric<T>(m, n, A, lda, x, y);
+    break;
+  }
+}
+
+#endif
@@ -2,24 +2,182 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <string.h>
 #include <mpi.h>
 #include <sys/time.h>
 #include <sstream>
 #include "logger.h"
+#include "../../common/gemm.h"
+#include "../../common/aligned-matrix.h"
+#include "../../common/matrix-file.h"
 
-void parseArgs(int argc, char *argv[], int *N)
+// How rank 0 gets B to the workers (-b)
+enum BcastMode
+{
+  BCAST_FLAT,
+  BCAST_TREE,
+  BCAST_CHAIN
+};
+
+struct Options
+{
+  int N;
+  bool dynamic;
+  int chunk;
+  BcastMode bcast;
+  int segment;
+  bool hugePages;
+  const char *inputA;
+  const char *inputB;
+  const char *outputC;
+  MatrixFileIo io;
+};
+
+void usage(char *prog)
+{
+  fprintf(stderr, "Usage: %s <N> [-m static|dynamic] [-c chunk] [-b flat|tree|chain] [-z segment] [-H] [-A fileA -B fileB] [-C fileC] [-i auto|mpiio|mmap]\n", prog);
+  fprintf(stderr, "  -m  row scheduling (default: static), dynamic hands out row chunks on demand\n");
+  fprintf(stderr, "  -c  rows per chunk of the dynamic mode (default: N / (4 * NP), at least 1)\n");
+  fprintf(stderr, "  -b  distribution of B (default: flat), tree and chain forward it through the workers\n");
+  fprintf(stderr, "  -z  ints per forwarded segment of B (default: 65536)\n");
+  fprintf(stderr, "  -H  back matrices of 2 MiB or more with transparent huge pages\n");
+  fprintf(stderr, "  -A  read A from a matrix file, every rank reads its own rows (static mode, needs -B)\n");
+  fprintf(stderr, "  -B  read B from a matrix file, every rank reads all of it\n");
+  fprintf(stderr, "  -C  write C to a matrix file\n");
+  fprintf(stderr, "  -i  matrix file access (default: auto), mmap on a single node, MPI-IO otherwise\n");
+}
+
+void parseArgs(int argc, char *argv[], Options *opt)
 {
   char *cp;
   long LN;
+  int c;
+
+  opt->dynamic = false;
+  opt->chunk = 0;
+  opt->bcast = BCAST_FLAT;
+  opt->segment = 65536;
+  opt->hugePages = false;
+  opt->inputA = NULL;
+  opt->inputB = NULL;
+  opt->outputC = NULL;
+  opt->io = MATRIX_IO_AUTO;
+
+  while ((c = getopt(argc, argv, "m:c:b:z:HA:B:C:i:")) != -1)
+  {
+    switch (c)
+    {
+    case 'm':
+      if (strcmp(optarg, "static") == 0)
+      {
+        opt->dynamic = false;
+      }
+      else if (strcmp(optarg, "dynamic") == 0)
+      {
+        opt->dynamic = true;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown scheduling mode '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'c':
+      opt->chunk = atoi(optarg);
+      if (opt->chunk < 1)
+      {
+        fprintf(stderr, "[ERROR] Chunk size must be positive, found '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'b':
+      if (strcmp(optarg, "flat") == 0)
+      {
+        opt->bcast = BCAST_FLAT;
+      }
+      else if (strcmp(optarg, "tree") == 0)
+      {
+        opt->bcast = BCAST_TREE;
+      }
+      else if (strcmp(optarg, "chain") == 0)
+      {
+        opt->bcast = BCAST_CHAIN;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown distribution of B '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'z':
+      opt->segment = atoi(optarg);
+      if (opt->segment < 1)
+      {
+        fprintf(stderr, "[ERROR] Segment size must be positive, found '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'H':
+      opt->hugePages = true;
+      break;
+    case 'A':
+      opt->inputA = optarg;
+      break;
+    case 'B':
+      opt->inputB = optarg;
+      break;
+    case 'C':
+      opt->outputC = optarg;
+      break;
+    case 'i':
+      if (strcmp(optarg, "auto") == 0)
+      {
+        opt->io = MATRIX_IO_AUTO;
+      }
+      else if (strcmp(optarg, "mpiio") == 0)
+      {
+        opt->io = MATRIX_IO_MPIIO;
+      }
+      else if (strcmp(optarg, "mmap") == 0)
+      {
+        opt->io = MATRIX_IO_MMAP;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown matrix file access '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if ((opt->inputA == NULL) != (opt->inputB == NULL))
+  {
+    fprintf(stderr, "[ERROR] Input files are given for both A and B (-A, -B) or for none\n");
+    exit(1);
+  }
+  if (opt->inputA && opt->dynamic)
+  {
+    fprintf(stderr, "[ERROR] Input files (-A, -B) need the static mode\n");
+    exit(1);
+  }
 
   // Check for the right number of arguments
-  if (argc != 2)
+  if (argc - optind != 1)
   {
-    fprintf(stderr, "[ERROR] Must be run with exactly 1 argument, found %d!\nUsage: %s <N>\n", argc - 1, argv[0]);
+    fprintf(stderr, "[ERROR] Must be run with exactly 1 argument, found %d!\n", argc - optind);
+    usage(argv[0]);
     exit(1);
   }
 
-  cp = argv[1];
+  cp = argv[optind];
   if (*cp == 0)
   {
     fprintf(stderr, "[ERROR] Argument is an empty string\n");
@@ -30,72 +188,340 @@ void parseArgs(int argc, char *argv[], int *N)
 
   if (*cp != 0)
   {
-    fprintf(stderr, "[ERROR] Argument '%s' is not an integer -- '%s'\n", argv[1], cp);
+    fprintf(stderr, "[ERROR] Argument '%s' is not an integer -- '%s'\n", argv[optind], cp);
     exit(1);
   }
 
-  *N = (int)LN;
+  opt->N = (int)LN;
 }
 
-int allocMatrix(int ***mat, int rows, int cols)
+// Balanced split of n rows into parts, counts differ by at most one
+void blockRange(int n, int parts, int idx, int *start, int *count)
 {
-  // Allocate rows*cols contiguous items
-  int *p = (int *)malloc(sizeof(int *) * rows * cols);
-  if (!p)
+  int q = n / parts;
+  int r = n % parts;
+
+  *count = q + (idx < r ? 1 : 0);
+  *start = idx * q + (idx < r ? idx : r);
+}
+
+// Allocate m or abort, matrices of this program always go to MPI as one
+// contiguous block
+void allocOrAbort(Matrix<int> *m, int rows, int cols, int flags, const char *name)
+{
+  if (m->allocate(rows, cols, flags) != 0)
   {
-    return -1;
+    fprintf(stderr, "[ERROR] Matrix alloc for %s failed!\n", name);
+    MPI_Abort(MPI_COMM_WORLD, 4);
   }
-  // Allocate row pointers
-  *mat = (int **)malloc(rows * sizeof(int *));
-  if (!mat)
+}
+
+void printMatrix(const Matrix<int> &mat)
+{
+  for (int i = 0; i < mat.rows(); i++)
   {
-    free(p);
-    return -1;
+    for (int j = 0; j < mat.cols(); j++)
+    {
+      printf("%6d  ", mat[i][j]);
+    }
+    printf("\n");
   }
+}
 
-  // Set up the pointers into the contiguous memory
-  for (int i = 0; i < rows; i++)
+// C = A * B for a rows x cols block of A and the cols x cols matrix B, through
+// the packed, register-tiled kernel of gemm.h (B is packed into contiguous
+// strips instead of being walked down its columns)
+void matrixMultiply(const int *A, const int *B, int rows, int cols, int *C)
+{
+  if (rows <= 0)
   {
-    (*mat)[i] = &(p[i * cols]);
+    return;
   }
-  return 0;
+
+  memset(C, 0, sizeof(int) * rows * cols);
+  matrixMultiplyAdd(rows, cols, cols, A, cols, B, cols, C, cols);
 }
 
-void printMatrix(int ***mat, int rows, int cols)
+// Read rows [first, first + count) of the N x N int matrix in path into m,
+// collective over MPI_COMM_WORLD
+void readRows(const Options *opt, const char *path, Matrix<int> *m, int first, int count)
 {
-  int i, j;
+  MatrixFile f;
+  int rank;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-  for (i = 0; i < rows; i++)
+  int status = matrixFileOpen(&f, path, MPI_COMM_WORLD, opt->io);
+  if (status != MATRIX_FILE_OK)
   {
-    for (j = 0; j < cols; j++)
+    if (rank == 0)
     {
-      printf("%6d  ", (*mat)[i][j]);
+      fprintf(stderr, "[ERROR] Matrix file %s: %s!\n", path, matrixFileError(status));
     }
-    printf("\n");
+    MPI_Abort(MPI_COMM_WORLD, 5);
+  }
+  if (f.header.type != MATRIX_FILE_INT32 || f.header.rows != opt->N || f.header.cols != opt->N)
+  {
+    if (rank == 0)
+    {
+      fprintf(stderr, "[ERROR] Matrix file %s holds a %lld x %lld %s matrix, expected %d x %d int32!\n", path,
+              (long long)f.header.rows, (long long)f.header.cols, matrixFileTypeName(f.header.type), opt->N, opt->N);
+    }
+    MPI_Abort(MPI_COMM_WORLD, 5);
+  }
+
+  if (matrixFileReadBlock(&f, first, count, 0, opt->N, m->data(), opt->N, MPI_INT) != MATRIX_FILE_OK)
+  {
+    fprintf(stderr, "[ERROR] Reading rows of %s in rank %d failed!\n", path, rank);
+    MPI_Abort(MPI_COMM_WORLD, 5);
+  }
+  matrixFileClose(&f);
+}
+
+// Write rows [first, first + count) of C to the output file (-C), collective
+// over MPI_COMM_WORLD, ranks without rows pass count = 0
+void writeRows(const Options *opt, const int *rows, int first, int count)
+{
+  MatrixFile f;
+  int rank;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  int status = matrixFileCreate(&f, opt->outputC, MPI_COMM_WORLD, MATRIX_FILE_INT32, opt->N, opt->N, opt->io);
+  if (status == MATRIX_FILE_OK)
+  {
+    status = matrixFileWriteBlock(&f, first, count, 0, opt->N, rows, opt->N, MPI_INT);
+  }
+  if (status != MATRIX_FILE_OK)
+  {
+    fprintf(stderr, "[ERROR] Matrix file %s in rank %d: %s!\n", opt->outputC, rank, matrixFileError(status));
+    MPI_Abort(MPI_COMM_WORLD, 5);
   }
+  matrixFileClose(&f);
 }
 
-void matrixMultiply(int **A, int **B, int rows, int cols, int ***C)
+MPI_Status status;
+
+// Row panels of rank 0's own multiply in static mode, the pending result
+// receives are progressed (MPI_Testall) between panels
+#define ROOT_PANELS 16
+
+// Get count ints of buf from rank 0 to every rank (tag=12) with point-to-point
+// messages. flat: rank 0 sends the whole buffer to each rank in turn. chain
+// and tree: the buffer is cut into segments, and every rank forwards each
+// segment to its successor (chain) or its binomial tree children (tree) as
+// soon as it has arrived. Rank 0 then only sends to one rank or to log2(size)
+// ranks, and the segments pipeline down the chain or tree
+void distributeB(int *buf, int count, BcastMode mode, int segment, int rank, int size)
 {
-  int k, i, j, val;
+  if (mode == BCAST_FLAT)
+  {
+    if (rank == 0)
+    {
+      for (int dest = 1; dest < size; dest++)
+      {
+        MPI_Send(buf, count, MPI_INT, dest, 12, MPI_COMM_WORLD);
+      }
+    }
+    else
+    {
+      MPI_Recv(buf, count, MPI_INT, 0, 12, MPI_COMM_WORLD, &status);
+    }
+    return;
+  }
+
+  int parent = -1;
+  int children[32];
+  int nChildren = 0;
 
-  for (k = 0; k < cols; k++)
+  if (mode == BCAST_CHAIN)
+  {
+    parent = rank - 1;
+    if (rank + 1 < size)
+    {
+      children[nChildren++] = rank + 1;
+    }
+  }
+  else
   {
-    for (i = 0; i < rows; i++)
+    // Rank r hangs below r minus its highest bit, and its children are
+    // r + m for the powers of two m above that bit, the largest subtree first
+    int mask = 1;
+    while (mask <= rank)
     {
-      val = 0;
+      mask <<= 1;
+    }
+    parent = rank - (mask >> 1);
 
-      for (j = 0; j < cols; j++)
+    int top = mask;
+    while (rank + top * 2 < size)
+    {
+      top *= 2;
+    }
+    for (int m = top; m >= mask; m /= 2)
+    {
+      if (rank + m < size)
       {
-        val += A[i][j] * B[j][k];
+        children[nChildren++] = rank + m;
       }
+    }
+  }
+
+  int nSegments = (count + segment - 1) / segment;
+  MPI_Request *reqs = (MPI_Request *)malloc(sizeof(MPI_Request) * (nSegments * nChildren + 1));
+  int nReqs = 0;
 
-      (*C)[i][k] = val;
+  for (int offset = 0; offset < count; offset += segment)
+  {
+    int len = count - offset < segment ? count - offset : segment;
+    if (rank > 0)
+    {
+      MPI_Recv(buf + offset, len, MPI_INT, parent, 12, MPI_COMM_WORLD, &status);
+    }
+    for (int c = 0; c < nChildren; c++)
+    {
+      MPI_Isend(buf + offset, len, MPI_INT, children[c], 12, MPI_COMM_WORLD, &reqs[nReqs++]);
     }
   }
+
+  MPI_Waitall(nReqs, reqs, MPI_STATUSES_IGNORE);
+  free(reqs);
 }
 
-MPI_Status status;
+// Send the next chunk of rows of A to dest (tag=1*), header {rowOffset, rows}.
+// Zero rows tells the worker to stop. Returns the number of rows sent
+int sendChunk(const Matrix<int> &A, int N, int chunk, int *next, int dest)
+{
+  int header[2];
+  header[0] = *next;
+  header[1] = N - *next < chunk ? N - *next : chunk;
+
+  MPI_Send(header, 2, MPI_INT, dest, 10, MPI_COMM_WORLD);
+  if (header[1] > 0)
+  {
+    MPI_Send(A[header[0]], header[1] * N, MPI_INT, dest, 11, MPI_COMM_WORLD);
+  }
+
+  *next += header[1];
+  return header[1];
+}
+
+// Rank 0 of the dynamic mode. Every worker gets B and one chunk, and each
+// returned result (tag=2*) is answered with the next chunk. While no result
+// is waiting, rank 0 multiplies a chunk itself, straight from A into C
+void masterDynamic(const Options *opt, const Matrix<int> &A, Matrix<int> &B, Matrix<int> &C, int chunk, int size, int *rowsDone,
+                   Logger *logger, double *compTime, double *mpiSendTime, double *mpiRecvTime)
+{
+  int N = opt->N;
+  int next = 0;
+  int busy = 0;
+  int header[2];
+
+  distributeB(B.data(), N * N, opt->bcast, opt->segment, 0, size);
+  for (int dest = 1; dest < size; dest++)
+  {
+    if (sendChunk(A, N, chunk, &next, dest) > 0)
+    {
+      busy++;
+    }
+  }
+  logger->log(mpiSendTime, "MPI_Send");
+
+  while (busy > 0 || next < N)
+  {
+    int flag = 0;
+    if (busy > 0)
+    {
+      MPI_Iprobe(MPI_ANY_SOURCE, 20, MPI_COMM_WORLD, &flag, &status);
+    }
+
+    if (!flag && next < N)
+    {
+      int rows = N - next < chunk ? N - next : chunk;
+      matrixMultiply(A[next], B.data(), rows, N, C[next]);
+      next += rows;
+      *rowsDone += rows;
+      logger->log(compTime, "COMP");
+      continue;
+    }
+
+    if (!flag)
+    {
+      MPI_Probe(MPI_ANY_SOURCE, 20, MPI_COMM_WORLD, &status);
+    }
+    int source = status.MPI_SOURCE;
+    MPI_Recv(header, 2, MPI_INT, source, 20, MPI_COMM_WORLD, &status);
+    MPI_Recv(C[header[0]], header[1] * N, MPI_INT, source, 21, MPI_COMM_WORLD, &status);
+    busy--;
+    logger->log(mpiRecvTime, "MPI_Recv");
+
+    if (sendChunk(A, N, chunk, &next, source) > 0)
+    {
+      busy++;
+    }
+    logger->log(mpiSendTime, "MPI_Send");
+  }
+}
+
+// Worker of the dynamic mode: multiply chunks until a zero-row chunk arrives
+void workerDynamic(const Options *opt, int chunk, int rank, int size, int *rowsDone,
+                   Logger *logger, double *compTime, double *mpiSendTime, double *mpiRecvTime)
+{
+  Matrix<int> B, localA, localC;
+  int N = opt->N;
+  int flags = opt->hugePages ? MATRIX_HUGE_PAGES : MATRIX_CONTIGUOUS;
+  int header[2];
+
+  allocOrAbort(&B, N, N, flags, "B");
+  allocOrAbort(&localA, chunk, N, flags, "localA");
+  allocOrAbort(&localC, chunk, N, flags, "localC");
+  logger->log(compTime, "COMP");
+
+  distributeB(B.data(), N * N, opt->bcast, opt->segment, rank, size);
+  logger->log(mpiRecvTime, "MPI_Recv");
+
+  while (true)
+  {
+    MPI_Recv(header, 2, MPI_INT, 0, 10, MPI_COMM_WORLD, &status);
+    if (header[1] == 0)
+    {
+      logger->log(mpiRecvTime, "MPI_Recv");
+      break;
+    }
+    MPI_Recv(localA.data(), header[1] * N, MPI_INT, 0, 11, MPI_COMM_WORLD, &status);
+    logger->log(mpiRecvTime, "MPI_Recv");
+
+    matrixMultiply(localA.data(), B.data(), header[1], N, localC.data());
+    *rowsDone += header[1];
+    logger->log(compTime, "COMP");
+
+    MPI_Send(header, 2, MPI_INT, 0, 20, MPI_COMM_WORLD);
+    MPI_Send(localC.data(), header[1] * N, MPI_INT, 0, 21, MPI_COMM_WORLD);
+    logger->log(mpiSendTime, "MPI_Send");
+  }
+}
+
+// Static split read from files (-A, -B): every rank reads its own rows of A
+// and all of B itself, nothing goes through rank 0
+void staticFromFiles(const Options *opt, int rowOffset, int rowsPerTask, Matrix<int> *C, Logger *logger,
+                     double *compTime, double *fileTime)
+{
+  Matrix<int> A, B;
+  int N = opt->N;
+  int flags = opt->hugePages ? MATRIX_HUGE_PAGES : MATRIX_CONTIGUOUS;
+
+  allocOrAbort(&A, rowsPerTask, N, flags, "A");
+  allocOrAbort(&B, N, N, flags, "B");
+  allocOrAbort(C, rowsPerTask, N, flags, "C");
+  logger->log(compTime, "COMP");
+
+  readRows(opt, opt->inputA, &A, rowOffset, rowsPerTask);
+  readRows(opt, opt->inputB, &B, 0, N);
+  logger->log(fileTime, "FILE");
+
+  matrixMultiply(A.data(), B.data(), rowsPerTask, N, C->data());
+  logger->log(compTime, "COMP");
+}
 
 int main(int argc, char *argv[])
 {
@@ -105,10 +531,20 @@ int main(int argc, char *argv[])
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-  parseArgs(argc, argv, &N);
+  Options opt;
+  parseArgs(argc, argv, &opt);
+  N = opt.N;
+
+  // Static split: rank r gets rowCount(r) rows starting at rowStart(r)
+  int rowOffset, rowsPerTask;
+  blockRange(N, size, rank, &rowOffset, &rowsPerTask);
 
-  int rowsPerTask = N / size;
-  int rowOffset = rowsPerTask;
+  int chunk = opt.chunk > 0 ? opt.chunk : N / (4 * size);
+  if (chunk < 1)
+  {
+    chunk = 1;
+  }
+  int rowsDone = 0;
 
   std::stringstream tl;
   tl << std::setw(2) << rank << ": [INFO] Timeline: ";
@@ -117,20 +553,52 @@ int main(int argc, char *argv[])
   double mpiSendTime = 0.0;
   double mpiRecvTime = 0.0;
   double mpiSendRecvTime = 0.0;
+  double fileTime = 0.0;
 
   // start profiling
   Logger logger(&tl);
 
-  int **A = NULL, **B = NULL, **C = NULL, **localA = NULL, **localB = NULL, **localC = NULL;
+  Matrix<int> A, B, C;
+  int flags = opt.hugePages ? MATRIX_HUGE_PAGES : MATRIX_CONTIGUOUS;
+
+  if (opt.inputA)
+  {
+    if (rank == 0)
+    {
+      fprintf(stdout, "%2d: [INFO] N: %d, NP: %d\n", rank, N, size);
+      fprintf(stdout, "%2d: [INFO] Kernel: %s\n", rank, gemmIsaName(gemmIsa()));
+      fprintf(stdout, "%2d: [INFO] A and B read from %s and %s\n", rank, opt.inputA, opt.inputB);
+    }
+
+    double start = MPI_Wtime();
+    staticFromFiles(&opt, rowOffset, rowsPerTask, &C, &logger, &compTime, &fileTime);
+    rowsDone = rowsPerTask;
 
-  if (rank == 0)
+    // The slowest rank ends the run. The reads are left out of Sys time so
+    // GFLOP/s compares with generated matrices, and reported on their own
+    double local[2] = {MPI_Wtime() - start - fileTime, fileTime}, slowest[2] = {0.0, 0.0};
+    MPI_Reduce(local, slowest, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    logger.log(&mpiRecvTime, "MPI_Reduce");
+    if (rank == 0)
+    {
+      fprintf(stdout, "%2d: [INFO] Read time: %.6f\n", rank, slowest[1]);
+      fprintf(stdout, "%2d: [INFO] Sys time: %.6f\n", rank, slowest[0]);
+      fprintf(stdout, "%2d: [INFO] GFLOP/s: %.3f\n", rank, 2.0 * N * N * N / slowest[0] * 1e-9);
+    }
+  }
+  else if (rank == 0)
   {
     fprintf(stdout, "%2d: [INFO] N: %d, NP: %d\n", rank, N, size);
+    fprintf(stdout, "%2d: [INFO] Kernel: %s\n", rank, gemmIsaName(gemmIsa()));
+    if (opt.bcast != BCAST_FLAT)
+    {
+      fprintf(stdout, "%2d: [INFO] B forwarded in a %s, segment: %d ints\n", rank, opt.bcast == BCAST_TREE ? "binomial tree" : "chain", opt.segment);
+    }
 
     struct timeval start, stop;
 
-    allocMatrix(&A, N, N);
-    allocMatrix(&B, N, N);
+    allocOrAbort(&A, N, N, flags, "A");
+    allocOrAbort(&B, N, N, flags, "B");
 
     for (i = 0; i < N; i++)
     {
@@ -143,103 +611,163 @@ int main(int argc, char *argv[])
     logger.log(&compTime, "COMP");
 
     // fprintf(stdout, "%2d: [INFO] Matrix A\n", rank);
-    // printMatrix(N, N, A);
+    // printMatrix(A);
 
     // fprintf(stdout, "%2d: [INFO] Matrix B\n", rank);
-    // printMatrix(N, N, B);
+    // printMatrix(B);
 
     gettimeofday(&start, 0);
 
-    // Send task (tag=1*)
-    for (dest = 1; dest < size; dest++)
+    if (opt.dynamic)
     {
-      MPI_Send(&rowOffset, 1, MPI_INT, dest, 10, MPI_COMM_WORLD);
-      MPI_Send(&(A[rowOffset][0]), rowsPerTask * N, MPI_INT, dest, 11, MPI_COMM_WORLD);
-      MPI_Send(&(B[0][0]), N * N, MPI_INT, dest, 12, MPI_COMM_WORLD);
+      fprintf(stdout, "%2d: [INFO] Dynamic scheduling, chunk: %d rows\n", rank, chunk);
 
-      // fprintf(stdout, "%2d: [INFO] Task sent to %d (rows %d, N %d)\n", rank, dest, rowsPerTask, N);
+      allocOrAbort(&C, N, N, flags, "C");
+      logger.log(&compTime, "COMP");
 
-      rowOffset += rowsPerTask;
+      masterDynamic(&opt, A, B, C, chunk, size, &rowsDone, &logger, &compTime, &mpiSendTime, &mpiRecvTime);
     }
-    logger.log(&mpiSendTime, "MPI_Send");
+    else
+    {
+      allocOrAbort(&C, N, N, flags, "C");
+      logger.log(&compTime, "COMP");
+
+      // Post the receives of all results (tag=2*) straight into C, before
+      // any task goes out
+      MPI_Request *reqs = (MPI_Request *)malloc(sizeof(MPI_Request) * 2 * size);
+      int *offsets = (int *)malloc(sizeof(int) * size);
+      int nReqs = 0;
+      for (source = 1; source < size; source++)
+      {
+        int sourceOffset, sourceRows;
+        blockRange(N, size, source, &sourceOffset, &sourceRows);
+        MPI_Irecv(&offsets[source], 1, MPI_INT, source, 20, MPI_COMM_WORLD, &reqs[nReqs++]);
+        MPI_Irecv(C[sourceOffset], sourceRows * N, MPI_INT, source, 21, MPI_COMM_WORLD, &reqs[nReqs++]);
+      }
+      logger.log(&mpiRecvTime, "MPI_Irecv");
 
-    allocMatrix(&localA, rowsPerTask, N);
-    allocMatrix(&localB, N, N);
-    logger.log(&compTime, "COMP");
+      // Send task (tag=1*)
+      for (dest = 1; dest < size; dest++)
+      {
+        int destOffset, destRows;
+        blockRange(N, size, dest, &destOffset, &destRows);
 
-    // Send & receive task to/from self (rank 0)
-    MPI_Sendrecv(&(A[0][0]), rowsPerTask * N, MPI_INT, 0, 13, &(localA[0][0]), rowsPerTask * N, MPI_INT, 0, 13, MPI_COMM_WORLD, &status);
-    MPI_Sendrecv(&(B[0][0]), N * N, MPI_INT, 0, 14, &(localB[0][0]), N * N, MPI_INT, 0, 14, MPI_COMM_WORLD, &status);
-    logger.log(&mpiSendRecvTime, "MPI_Sendrecv");
+        MPI_Send(&destOffset, 1, MPI_INT, dest, 10, MPI_COMM_WORLD);
+        MPI_Send(A[destOffset], destRows * N, MPI_INT, dest, 11, MPI_COMM_WORLD);
 
-    allocMatrix(&C, N, N);
-    logger.log(&compTime, "COMP");
+        // fprintf(stdout, "%2d: [INFO] Task sent to %d (rows %d, N %d)\n", rank, dest, destRows, N);
+      }
+      distributeB(B.data(), N * N, opt.bcast, opt.segment, rank, size);
+      logger.log(&mpiSendTime, "MPI_Send");
 
-    // Receive result (tag=2*)
-    for (source = 1; source < size; source++)
-    {
-      MPI_Recv(&rowOffset, 1, MPI_INT, source, 20, MPI_COMM_WORLD, &status);
-      MPI_Recv(&(C[rowOffset][0]), rowsPerTask * N, MPI_INT, source, 21, MPI_COMM_WORLD, &status);
+      // Multiply in rank 0 on views of the first rows of A and C, in panels
+      // so the pending receives progress in between
+      int panelRows = (rowsPerTask + ROOT_PANELS - 1) / ROOT_PANELS;
+      if (panelRows < 1)
+      {
+        panelRows = 1;
+      }
+      int done = nReqs == 0;
+      for (int r = 0; r < rowsPerTask; r += panelRows)
+      {
+        int rows = rowsPerTask - r < panelRows ? rowsPerTask - r : panelRows;
+        matrixMultiply(A[r], B.data(), rows, N, C[r]);
 
-      // fprintf(stdout, "%2d: [INFO] Result received from %d\n", rank, source);
-    }
-    logger.log(&mpiRecvTime, "MPI_Recv");
+        if (!done)
+        {
+          MPI_Testall(nReqs, reqs, &done, MPI_STATUSES_IGNORE);
+        }
+      }
+      logger.log(&compTime, "COMP");
 
-    allocMatrix(&localC, rowsPerTask, N);
+      // Drain the results in order of arrival
+      for (i = 0; i < nReqs; i++)
+      {
+        int idx;
+        MPI_Waitany(nReqs, reqs, &idx, &status);
 
-    // Multiply in rank 0
-    matrixMultiply(localA, localB, rowsPerTask, N, &localC);
-    logger.log(&compTime, "COMP");
+        // fprintf(stdout, "%2d: [INFO] Result received from %d\n", rank, status.MPI_SOURCE);
+      }
+      logger.log(&mpiRecvTime, "MPI_Waitany");
 
-    // Send & receive result to/from self (rank 0)
-    MPI_Sendrecv(&(localC[0][0]), rowsPerTask * N, MPI_INT, 0, 22, &(C[0][0]), rowsPerTask * N, MPI_INT, 0, 22, MPI_COMM_WORLD, &status);
-    logger.log(&mpiSendRecvTime, "MPI_Sendrecv");
+      free(reqs);
+      free(offsets);
+      rowsDone = rowsPerTask;
+    }
 
     gettimeofday(&stop, 0);
 
     // Print result
     // fprintf(stdout, "%2d: [INFO] Matrix result\n", rank);
-    // printMatrix(&C, N, N);
+    // printMatrix(C);
 
-    fprintf(stdout, "%2d: [INFO] Sys time: %.6f\n", rank, (stop.tv_sec + stop.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6));
+    double sysTime = (stop.tv_sec + stop.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6);
+    fprintf(stdout, "%2d: [INFO] Sys time: %.6f\n", rank, sysTime);
+    fprintf(stdout, "%2d: [INFO] GFLOP/s: %.3f\n", rank, 2.0 * N * N * N / sysTime * 1e-9);
   }
 
-  if (rank > 0)
+  if (opt.inputA)
+  {
+    // Done above
+  }
+  else if (rank > 0 && opt.dynamic)
   {
-    allocMatrix(&A, rowsPerTask, N);
-    allocMatrix(&B, N, N);
+    workerDynamic(&opt, chunk, rank, size, &rowsDone, &logger, &compTime, &mpiSendTime, &mpiRecvTime);
+  }
+  else if (rank > 0)
+  {
+    allocOrAbort(&A, rowsPerTask, N, flags, "A");
+    allocOrAbort(&B, N, N, flags, "B");
     logger.log(&compTime, "COMP");
 
     // Receive task (tag=1)
     MPI_Recv(&rowOffset, 1, MPI_INT, 0, 10, MPI_COMM_WORLD, &status);
-    MPI_Recv(&(A[0][0]), rowsPerTask * N, MPI_INT, 0, 11, MPI_COMM_WORLD, &status);
-    MPI_Recv(&(B[0][0]), N * N, MPI_INT, 0, 12, MPI_COMM_WORLD, &status);
+    MPI_Recv(A.data(), rowsPerTask * N, MPI_INT, 0, 11, MPI_COMM_WORLD, &status);
+    distributeB(B.data(), N * N, opt.bcast, opt.segment, rank, size);
     logger.log(&mpiRecvTime, "MPI_Recv");
 
     // fprintf(stdout, "%2d: [INFO] Task received (rows %d, N %d)\n", rank, rowsPerTask, N);
 
-    allocMatrix(&C, rowsPerTask, N);
+    allocOrAbort(&C, rowsPerTask, N, flags, "C");
 
     // Run task
-    matrixMultiply(A, B, rowsPerTask, N, &C);
+    matrixMultiply(A.data(), B.data(), rowsPerTask, N, C.data());
     logger.log(&compTime, "COMP");
 
     // Send result (tag=2)
     MPI_Send(&rowOffset, 1, MPI_INT, 0, 20, MPI_COMM_WORLD);
-    MPI_Send(&(C[0][0]), rowsPerTask * N, MPI_INT, 0, 21, MPI_COMM_WORLD);
+    MPI_Send(C.data(), rowsPerTask * N, MPI_INT, 0, 21, MPI_COMM_WORLD);
     logger.log(&mpiSendTime, "MPI_Send");
+    rowsDone = rowsPerTask;
 
     // fprintf(stdout, "%2d: [INFO] Result sent\n", rank);
   }
 
+  if (opt.outputC)
+  {
+    // Each rank writes the rows it computed when reading from files, rank 0
+    // holds all of C otherwise
+    if (opt.inputA)
+    {
+      writeRows(&opt, C.data(), rowOffset, rowsPerTask);
+    }
+    else
+    {
+      writeRows(&opt, rank == 0 ? C.data() : NULL, 0, rank == 0 ? N : 0);
+    }
+    logger.log(&fileTime, "FILE");
+  }
+
   MPI_Finalize();
 
   double mpiTime = mpiSendTime + mpiRecvTime + mpiSendRecvTime;
-  double totalTime = compTime + mpiTime;
+  double totalTime = compTime + mpiTime + fileTime;
 
   std::cout << std::setw(2) << rank << ": [INFO] Send  time: " << std::setprecision(6) << mpiSendTime << std::endl;
   std::cout << std::setw(2) << rank << ": [INFO] Recv  time: " << std::setprecision(6) << mpiRecvTime << std::endl;
   std::cout << std::setw(2) << rank << ": [INFO] SndR. time: " << std::setprecision(6) << mpiSendRecvTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] File  time: " << std::setprecision(6) << fileTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Rows  done: " << rowsDone << std::endl;
   std::cout << std::setw(2) << rank << ": [INFO] COMM. TIME: " << std::setprecision(6) << mpiTime << std::endl;
   std::cout << std::setw(2) << rank << ": [INFO] COMP. TIME: " << std::setprecision(6) << compTime << std::endl;
   std::cout << std::setw(2) << rank << ": [INFO] TOTAL TIME: " << std::setprecision(6) << totalTime << std::endl;
@@ -2,24 +2,176 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <string.h>
 #include <mpi.h>
 #include <sys/time.h>
 #include <sstream>
 #include "logger.h"
+#include "../../common/gemm.h"
+#include "gemv.h"
+#include "../../common/aligned-matrix.h"
 
-void parseArgs(int argc, char *argv[], int *N)
+enum DataType
+{
+  DATA_INT32,
+  DATA_FLOAT,
+  DATA_DOUBLE
+};
+
+// How A is split over the ranks (-p)
+enum Partition
+{
+  PART_ROW,
+  PART_COL,
+  PART_2D
+};
+
+struct Options
+{
+  int N;
+  int vectors;
+  int block;
+  DataType dataType;
+  Partition partition;
+};
+
+struct Timing
+{
+  double compTime = 0.0;
+  double mpiSendTime = 0.0;
+  double mpiRecvTime = 0.0;
+  double mpiSendRecvTime = 0.0;
+  double mpiBcastTime = 0.0;
+  double mpiGathervTime = 0.0;
+  double mpiScattervTime = 0.0;
+  double mpiReduceScatterTime = 0.0;
+  double mpiCartTime = 0.0;
+  double mpiTypeTime = 0.0;
+
+  // Time spent inside the local GEMV/GEMM kernel only
+  double kernelTime = 0.0;
+};
+
+template <typename T>
+struct MpiTraits;
+
+template <>
+struct MpiTraits<int>
+{
+  static MPI_Datatype type() { return MPI_INT; }
+  static const char *name() { return "int32"; }
+};
+
+template <>
+struct MpiTraits<float>
+{
+  static MPI_Datatype type() { return MPI_FLOAT; }
+  static const char *name() { return "float"; }
+};
+
+template <>
+struct MpiTraits<double>
+{
+  static MPI_Datatype type() { return MPI_DOUBLE; }
+  static const char *name() { return "double"; }
+};
+
+void usage(char *prog)
+{
+  fprintf(stderr, "Usage: %s <N> [-v vectors] [-k block] [-T int|float|double] [-p row|col|2d]\n", prog);
+  fprintf(stderr, "  -v  vectors multiplied with the resident A (default: 1)\n");
+  fprintf(stderr, "  -k  vectors per broadcast block, multiplied as one GEMM (default: 1)\n");
+  fprintf(stderr, "  -T  element type (default: int)\n");
+  fprintf(stderr, "  -p  partition of A (default: row), col splits by columns, 2d into grid blocks\n");
+}
+
+void parseArgs(int argc, char *argv[], Options *opt)
 {
   char *cp;
   long LN;
+  int c;
+
+  opt->vectors = 1;
+  opt->block = 1;
+  opt->dataType = DATA_INT32;
+  opt->partition = PART_ROW;
+
+  while ((c = getopt(argc, argv, "v:k:T:p:")) != -1)
+  {
+    switch (c)
+    {
+    case 'v':
+      opt->vectors = atoi(optarg);
+      if (opt->vectors < 1)
+      {
+        fprintf(stderr, "[ERROR] Vector count must be positive, found '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'k':
+      opt->block = atoi(optarg);
+      if (opt->block < 1)
+      {
+        fprintf(stderr, "[ERROR] Block size must be positive, found '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'T':
+      if (strcmp(optarg, "int") == 0 || strcmp(optarg, "int32") == 0)
+      {
+        opt->dataType = DATA_INT32;
+      }
+      else if (strcmp(optarg, "float") == 0)
+      {
+        opt->dataType = DATA_FLOAT;
+      }
+      else if (strcmp(optarg, "double") == 0)
+      {
+        opt->dataType = DATA_DOUBLE;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown element type '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'p':
+      if (strcmp(optarg, "row") == 0)
+      {
+        opt->partition = PART_ROW;
+      }
+      else if (strcmp(optarg, "col") == 0)
+      {
+        opt->partition = PART_COL;
+      }
+      else if (strcmp(optarg, "2d") == 0)
+      {
+        opt->partition = PART_2D;
+      }
+      else
+      {
+        fprintf(stderr, "[ERROR] Unknown partition '%s'\n", optarg);
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      exit(1);
+    }
+  }
 
   // Check for the right number of arguments
-  if (argc != 2)
+  if (argc - optind != 1)
   {
-    fprintf(stderr, "[ERROR] Must be run with exactly 1 argument, found %d!\nUsage: %s <N>\n", argc - 1, argv[0]);
+    fprintf(stderr, "[ERROR] Must be run with exactly 1 argument, found %d!\n", argc - optind);
+    usage(argv[0]);
     exit(1);
   }
 
-  cp = argv[1];
+  cp = argv[optind];
   if (*cp == 0)
   {
     fprintf(stderr, "[ERROR] Argument is an empty string\n");
@@ -30,220 +182,492 @@ void parseArgs(int argc, char *argv[], int *N)
 
   if (*cp != 0)
   {
-    fprintf(stderr, "[ERROR] Argument '%s' is not an integer -- '%s'\n", argv[1], cp);
+    fprintf(stderr, "[ERROR] Argument '%s' is not an integer -- '%s'\n", argv[optind], cp);
     exit(1);
   }
 
-  *N = (int)LN;
+  opt->N = (int)LN;
 }
 
-int allocMatrix(int ***mat, int rows, int cols)
+// Balanced split of n rows into parts, counts differ by at most one
+void blockRange(int n, int parts, int idx, int *start, int *count)
 {
-  // Allocate rows*cols contiguous items
-  int *p = (int *)malloc(sizeof(int *) * rows * cols);
-  if (!p)
+  int q = n / parts;
+  int r = n % parts;
+
+  *count = q + (idx < r ? 1 : 0);
+  *start = idx * q + (idx < r ? idx : r);
+}
+
+// Print a rows x width block stored row-major
+template <typename T>
+void printBlock(const T *Y, int rows, int width)
+{
+  for (int i = 0; i < rows; i++)
   {
-    return -1;
+    for (int j = 0; j < width; j++)
+    {
+      std::cout << std::setw(6) << Y[(size_t)i * width + j] << "  ";
+    }
+    std::cout << std::endl;
   }
-  // Allocate row pointers
-  *mat = (int **)malloc(rows * sizeof(int *));
-  if (!mat)
+}
+
+// Y = A * X for a rows x cols block of A (leading dimension lda) and a block
+// of width vectors, stored as the columns of the cols x width matrix X (Y is
+// rows x width). A single vector goes through the GEMV kernel, wider blocks
+// through the GEMM kernel
+template <typename T>
+void matrixMultiply(const T *A, int lda, const T *X, int rows, int cols, int width, T *Y)
+{
+  if (rows <= 0)
   {
-    free(p);
-    return -1;
+    return;
   }
 
-  // Set up the pointers into the contiguous memory
-  for (int i = 0; i < rows; i++)
+  memset(Y, 0, sizeof(T) * rows * width);
+  if (width == 1)
   {
-    (*mat)[i] = &(p[i * cols]);
+    matrixVectorMultiplyAdd(rows, cols, A, lda, X, Y);
+  }
+  else
+  {
+    matrixMultiplyAdd(rows, width, cols, A, lda, X, width, Y, width);
   }
-  return 0;
 }
 
-void printMatrix(int ***mat, int rows, int cols)
+// Vector v of the stream has every entry set to v % 7 + 1
+template <typename T>
+void generateBlock(T *X, int N, int first, int width)
 {
-  int i, j;
-
-  for (i = 0; i < rows; i++)
+  for (int i = 0; i < N; i++)
   {
-    for (j = 0; j < cols; j++)
+    for (int v = 0; v < width; v++)
     {
-      printf("%6d  ", (*mat)[i][j]);
+      X[(size_t)i * width + v] = (T)((first + v) % 7 + 1);
     }
-    printf("\n");
   }
 }
 
-void matrixMultiply(int **A, int **B, int rows, int cols, int ***C)
+// STREAM triad a = b + s * c, run by every rank at once
+#define STREAM_N (1 << 21)
+#define STREAM_REPS 5
+
+// Aggregate memory bandwidth of all ranks (GB/s, best of STREAM_REPS, the
+// STREAM convention of 3 * 8 bytes per element), the ceiling for GEMV
+double streamBandwidth()
 {
-  int k, i, j, val;
+  double *a = (double *)malloc(sizeof(double) * STREAM_N);
+  double *b = (double *)malloc(sizeof(double) * STREAM_N);
+  double *c = (double *)malloc(sizeof(double) * STREAM_N);
+  double best = 0.0;
+  int size;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-  for (k = 0; k < cols; k++)
+  if (!a || !b || !c)
   {
-    for (i = 0; i < rows; i++)
-    {
-      val = 0;
+    fprintf(stderr, "[ERROR] STREAM arrays alloc failed!\n");
+    MPI_Abort(MPI_COMM_WORLD, 3);
+  }
 
-      for (j = 0; j < cols; j++)
-      {
-        val += A[i][j] * B[j][k];
-      }
+  for (int i = 0; i < STREAM_N; i++)
+  {
+    a[i] = 0.0;
+    b[i] = 1.0;
+    c[i] = 2.0;
+  }
 
-      (*C)[i][k] = val;
+  for (int rep = 0; rep < STREAM_REPS; rep++)
+  {
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    for (int i = 0; i < STREAM_N; i++)
+    {
+      a[i] = b[i] + 3.0 * c[i];
     }
+    MPI_Barrier(MPI_COMM_WORLD);
+    double elapsed = MPI_Wtime() - start;
+    best = rep == 0 || elapsed < best ? elapsed : best;
   }
-}
-
-MPI_Status status;
 
-int main(int argc, char *argv[])
-{
-  int rank, size, N, i, j, k, dest, source;
+  // Keep the triad from being optimised away
+  if (a[STREAM_N / 2] != 7.0)
+  {
+    fprintf(stderr, "[ERROR] STREAM triad check failed!\n");
+  }
 
-  MPI_Init(&argc, &argv);
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  free(a);
+  free(b);
+  free(c);
 
-  parseArgs(argc, argv, &N);
+  return 3.0 * sizeof(double) * STREAM_N * size / best * 1e-9;
+}
 
-  int rowsPerTask = N / size;
-  int rowOffset = rowsPerTask;
+MPI_Status status;
 
-  std::stringstream tl;
-  tl << std::setw(2) << rank << ": [INFO] Timeline: ";
+// Grid shape of each partition: rows of A are split over dim[0], columns
+// over dim[1]. Row is p x 1, col is 1 x p, 2d the MPI_Dims_create grid
+void partitionDims(Partition partition, int size, int dim[2])
+{
+  if (partition == PART_ROW)
+  {
+    dim[0] = size;
+    dim[1] = 1;
+  }
+  else if (partition == PART_COL)
+  {
+    dim[0] = 1;
+    dim[1] = size;
+  }
+  else
+  {
+    dim[0] = 0;
+    dim[1] = 0;
+    MPI_Dims_create(size, 2, dim);
+  }
+}
 
-  double compTime = 0;
-  double mpiSendTime = 0.0;
-  double mpiRecvTime = 0.0;
-  double mpiSendRecvTime = 0.0;
+const char *partitionName(Partition partition)
+{
+  switch (partition)
+  {
+  case PART_COL:
+    return "col";
+  case PART_2D:
+    return "2d";
+  default:
+    return "row";
+  }
+}
 
-  // start profiling
-  Logger logger(&tl);
+// All three partitions run on one pr x pc grid. Rank (r, c) holds the block
+// of A at row block r and column block c. Per batch, rank 0 scatters the x
+// segments over grid row 0 and each grid column broadcasts its segment, so a
+// rank only receives the N / pc entries of x it multiplies. The partial y of
+// a grid row is summed with MPI_Reduce_scatter, which leaves every rank of
+// the row one piece of it, and the pieces are gathered at rank 0.
+template <typename T>
+void run(const Options *opt, double stream, Logger *logger, Timing *t)
+{
+  int rank, size, N = opt->N, i, j;
+  MPI_Datatype elemType = MpiTraits<T>::type();
+  int dim[2], period[2] = {0, 0}, coord[2];
+  int rowDims[2] = {0, 1}, colDims[2] = {1, 0};
+  MPI_Comm cartComm, rowComm, colComm;
 
-  int **A = NULL, **B = NULL, **C = NULL, **localA = NULL, **localB = NULL, **localC = NULL;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  partitionDims(opt->partition, size, dim);
+  logger->log(&t->compTime, "COMP");
+
+  // No reordering, grid rank equals world rank and rank 0 holds A
+  MPI_Cart_create(MPI_COMM_WORLD, 2, dim, period, 0, &cartComm);
+  MPI_Comm_rank(cartComm, &rank);
+  MPI_Cart_coords(cartComm, rank, 2, coord);
+  MPI_Cart_sub(cartComm, rowDims, &rowComm);
+  MPI_Cart_sub(cartComm, colDims, &colComm);
+  logger->log(&t->mpiCartTime, "MPI_Cart_");
+
+  int pr = dim[0], pc = dim[1];
+  int rowOffset, rows, colOffset, cols;
+  blockRange(N, pr, coord[0], &rowOffset, &rows);
+  blockRange(N, pc, coord[1], &colOffset, &cols);
+
+  // Piece of the grid row's y that MPI_Reduce_scatter leaves on this rank
+  int pieceOffset, pieceRows;
+  blockRange(rows, pc, coord[1], &pieceOffset, &pieceRows);
+
+  int block = opt->block < opt->vectors ? opt->block : opt->vectors;
+  int nBatches = (opt->vectors + block - 1) / block;
+
+  // Per-batch latency, broadcast of X to gather of Y (rank 0)
+  double batchMin = 0.0, batchMax = 0.0, batchSum = 0.0;
+
+  // A is padded so its rows start on cache lines and do not all map to the
+  // same cache sets, rows are stride() apart rather than N
+  Matrix<T> A, localA;
+  T *X = NULL, *Y = NULL, *localX = NULL, *localY = NULL, *pieceY = NULL;
+  const T *blockA;
+  int lda;
+  int *counts = NULL, *displs = NULL, *xCounts = NULL, *xDispls = NULL, *pieceCounts = NULL;
+
+  struct timeval start, distributed, stop;
 
   if (rank == 0)
   {
-    fprintf(stdout, "%2d: [INFO] N: %d, NP: %d\n", rank, N, size);
+    fprintf(stdout, "%2d: [INFO] N: %d, NP: %d, vectors: %d, block: %d\n", rank, N, size, opt->vectors, block);
+    fprintf(stdout, "%2d: [INFO] Element type: %s (%d bytes)\n", rank, MpiTraits<T>::name(), (int)sizeof(T));
+    fprintf(stdout, "%2d: [INFO] Partition: %s (%d x %d grid)\n", rank, partitionName(opt->partition), pr, pc);
 
-    struct timeval start, stop;
-
-    allocMatrix(&A, N, N);
-    allocMatrix(&B, N, 1);
+    if (A.allocate(N, N, MATRIX_PADDED) != 0)
+    {
+      fprintf(stderr, "[ERROR] Matrix alloc for A failed!\n");
+      MPI_Abort(MPI_COMM_WORLD, 4);
+    }
 
     for (i = 0; i < N; i++)
     {
       for (j = 0; j < N; j++)
       {
-        A[i][j] = i + 1;
+        A[i][j] = (T)(i + 1);
       }
-
-      B[i][0] = 1;
     }
 
     // fprintf(stdout, "%2d: [INFO] Matrix A\n", rank);
-    // printMatrix(N, N, A);
-
-    // fprintf(stdout, "%2d: [INFO] Matrix B\n", rank);
-    // printMatrix(N, N, B);
+    // printBlock(A.data(), N, A.stride());
 
     gettimeofday(&start, 0);
 
-    // Send task (tag=1*)
-    logger.log(&compTime, "COMP");
-    for (dest = 1; dest < size; dest++)
+    // Send task (tag=11), A stays on the workers for the whole stream. A
+    // block of a column split is strided in A and goes out as a vector type
+    logger->log(&t->compTime, "COMP");
+    for (int dest = 1; dest < size; dest++)
+    {
+      int destCoord[2], destRowOffset, destRows, destColOffset, destCols;
+      MPI_Datatype blockType;
+
+      MPI_Cart_coords(cartComm, dest, 2, destCoord);
+      blockRange(N, pr, destCoord[0], &destRowOffset, &destRows);
+      blockRange(N, pc, destCoord[1], &destColOffset, &destCols);
+      if (destRows == 0 || destCols == 0)
+      {
+        continue;
+      }
+
+      MPI_Type_vector(destRows, destCols, A.stride(), elemType, &blockType);
+      MPI_Type_commit(&blockType);
+      logger->log(&t->mpiTypeTime, "MPI_Type_");
+
+      MPI_Send(A[destRowOffset] + destColOffset, 1, blockType, dest, 11, cartComm);
+      logger->log(&t->mpiSendTime, "MPI_Send");
+
+      MPI_Type_free(&blockType);
+      logger->log(&t->mpiTypeTime, "MPI_Type_");
+
+      // fprintf(stdout, "%2d: [INFO] Task sent to %d (rows %d, cols %d)\n", rank, dest, destRows, destCols);
+    }
+
+    // Rank 0 multiplies its own block in place
+    blockA = A[rowOffset] + colOffset;
+    lda = A.stride();
+
+    X = (T *)malloc(sizeof(T) * N * block);
+    Y = (T *)malloc(sizeof(T) * N * block);
+    counts = (int *)malloc(sizeof(int) * size);
+    displs = (int *)malloc(sizeof(int) * size);
+  }
+  else
+  {
+    if (localA.allocate(rows > 0 ? rows : 1, cols > 0 ? cols : 1, MATRIX_PADDED) != 0)
+    {
+      fprintf(stderr, "[ERROR] Matrix alloc for localA failed!\n");
+      MPI_Abort(MPI_COMM_WORLD, 4);
+    }
+
+    // Receive task (tag=11), unpacked straight into the padded rows
+    logger->log(&t->compTime, "COMP");
+    if (rows > 0 && cols > 0)
     {
-      MPI_Send(&rowOffset, 1, MPI_INT, dest, 10, MPI_COMM_WORLD);
-      MPI_Send(&(A[rowOffset][0]), rowsPerTask * N, MPI_INT, dest, 11, MPI_COMM_WORLD);
-      MPI_Send(&(B[0][0]), N, MPI_INT, dest, 12, MPI_COMM_WORLD);
+      MPI_Datatype rowsType;
+
+      MPI_Type_vector(rows, cols, localA.stride(), elemType, &rowsType);
+      MPI_Type_commit(&rowsType);
+      logger->log(&t->mpiTypeTime, "MPI_Type_");
 
-      // fprintf(stdout, "%2d: [INFO] Task sent to %d (rows %d, N %d)\n", rank, dest, rowsPerTask, N);
+      MPI_Recv(localA.data(), 1, rowsType, 0, 11, cartComm, &status);
+      logger->log(&t->mpiRecvTime, "MPI_Recv");
 
-      rowOffset += rowsPerTask;
+      MPI_Type_free(&rowsType);
+      logger->log(&t->mpiTypeTime, "MPI_Type_");
     }
-    logger.log(&mpiSendTime, "MPI_Send");
 
-    allocMatrix(&localA, rowsPerTask, N);
-    allocMatrix(&localB, N, 1);
-    logger.log(&compTime, "COMP");
+    // fprintf(stdout, "%2d: [INFO] Task received (rows %d, cols %d)\n", rank, rows, cols);
 
-    // Send & receive task to/from self (rank 0)
-    MPI_Sendrecv(&(A[0][0]), rowsPerTask * N, MPI_INT, 0, 13, &(localA[0][0]), rowsPerTask * N, MPI_INT, 0, 13, MPI_COMM_WORLD, &status);
-    MPI_Sendrecv(&(B[0][0]), N, MPI_INT, 0, 14, &(localB[0][0]), N, MPI_INT, 0, 14, MPI_COMM_WORLD, &status);
-    logger.log(&mpiSendRecvTime, "MPI_Sendrecv");
+    blockA = localA.data();
+    lda = localA.stride();
+  }
 
-    allocMatrix(&C, N, 1);
+  localX = (T *)malloc(sizeof(T) * (cols > 0 ? cols : 1) * block);
+  localY = (T *)malloc(sizeof(T) * (rows > 0 ? rows : 1) * block);
+  pieceY = (T *)malloc(sizeof(T) * (pieceRows > 0 ? pieceRows : 1) * block);
+  xCounts = (int *)malloc(sizeof(int) * pc);
+  xDispls = (int *)malloc(sizeof(int) * pc);
+  pieceCounts = (int *)malloc(sizeof(int) * pc);
 
-    // Receive result (tag=2*)
-    logger.log(&compTime, "COMP");
-    for (source = 1; source < size; source++)
+  if (rank == 0)
+  {
+    gettimeofday(&distributed, 0);
+  }
+
+  // Stream the vectors through A in blocks of up to block vectors
+  for (int batch = 0; batch < nBatches; batch++)
+  {
+    int first = batch * block;
+    int width = opt->vectors - first < block ? opt->vectors - first : block;
+    double batchStart = 0.0;
+
+    for (int c = 0; c < pc; c++)
     {
-      MPI_Recv(&rowOffset, 1, MPI_INT, source, 20, MPI_COMM_WORLD, &status);
-      MPI_Recv(&(C[rowOffset][0]), rowsPerTask, MPI_INT, source, 21, MPI_COMM_WORLD, &status);
+      int offset, count;
+      blockRange(N, pc, c, &offset, &count);
+      xCounts[c] = count * width;
+      xDispls[c] = offset * width;
 
-      // fprintf(stdout, "%2d: [INFO] Result received from %d\n", rank, source);
+      blockRange(rows, pc, c, &offset, &count);
+      pieceCounts[c] = count * width;
     }
-    logger.log(&mpiRecvTime, "MPI_Recv");
 
-    allocMatrix(&localC, rowsPerTask, 1);
+    if (rank == 0)
+    {
+      generateBlock(X, N, first, width);
+      for (int source = 0; source < size; source++)
+      {
+        int sourceCoord[2], sourceRowOffset, sourceRows, sourcePieceOffset, sourcePieceRows;
 
-    // Multiply in rank 0
-    matrixMultiply(localA, localB, rowsPerTask, 1, &localC);
+        MPI_Cart_coords(cartComm, source, 2, sourceCoord);
+        blockRange(N, pr, sourceCoord[0], &sourceRowOffset, &sourceRows);
+        blockRange(sourceRows, pc, sourceCoord[1], &sourcePieceOffset, &sourcePieceRows);
+        counts[source] = sourcePieceRows * width;
+        displs[source] = (sourceRowOffset + sourcePieceOffset) * width;
+      }
+      batchStart = MPI_Wtime();
+    }
+    logger->log(&t->compTime, "COMP");
 
-    // Send & receive result to/from self (rank 0)
-    logger.log(&compTime, "COMP");
-    MPI_Sendrecv(&(localC[0][0]), rowsPerTask, MPI_INT, 0, 22, &(C[0][0]), rowsPerTask, MPI_INT, 0, 22, MPI_COMM_WORLD, &status);
-    logger.log(&mpiSendRecvTime, "MPI_Sendrecv");
+    // x segments to grid row 0, then down each grid column
+    if (coord[0] == 0)
+    {
+      MPI_Scatterv(X, xCounts, xDispls, elemType, localX, cols * width, elemType, 0, rowComm);
+      logger->log(&t->mpiScattervTime, "MPI_Scatterv");
+    }
+    MPI_Bcast(localX, cols * width, elemType, 0, colComm);
+    logger->log(&t->mpiBcastTime, "MPI_Bcast");
 
-    gettimeofday(&stop, 0);
+    double kernelStart = MPI_Wtime();
+    matrixMultiply(blockA, lda, localX, rows, cols, width, localY);
+    t->kernelTime += MPI_Wtime() - kernelStart;
+    logger->log(&t->compTime, "COMP");
 
-    // Print result
-    // fprintf(stdout, "%2d: [INFO] Matrix result\n", rank);
-    // printMatrix(&C, N, 1);
+    // Sum the partial y across the grid row, one piece per rank
+    MPI_Reduce_scatter(localY, pieceY, pieceCounts, elemType, MPI_SUM, rowComm);
+    logger->log(&t->mpiReduceScatterTime, "MPI_Reduce_scatter");
 
-    fprintf(stdout, "%2d: [INFO] Sys time: %.6f\n", rank, (stop.tv_sec + stop.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6));
+    MPI_Gatherv(pieceY, pieceRows * width, elemType, Y, counts, displs, elemType, 0, cartComm);
+    logger->log(&t->mpiGathervTime, "MPI_Gatherv");
+
+    if (rank == 0)
+    {
+      double latency = MPI_Wtime() - batchStart;
+      batchMin = batch == 0 || latency < batchMin ? latency : batchMin;
+      batchMax = latency > batchMax ? latency : batchMax;
+      batchSum += latency;
+
+      // Print result
+      // fprintf(stdout, "%2d: [INFO] Batch %d result\n", rank, batch);
+      // printBlock(Y, N, width);
+    }
   }
 
-  if (rank > 0)
+  // The slowest rank bounds the rate A is streamed through the kernel
+  double kernelMax = 0.0;
+  MPI_Reduce(&t->kernelTime, &kernelMax, 1, MPI_DOUBLE, MPI_MAX, 0, cartComm);
+
+  if (rank == 0)
   {
-    allocMatrix(&A, rowsPerTask, N);
-    allocMatrix(&B, N, 1);
+    gettimeofday(&stop, 0);
+
+    double distTime = (distributed.tv_sec + distributed.tv_usec * 1e-6) - (start.tv_sec + start.tv_usec * 1e-6);
+    double streamTime = (stop.tv_sec + stop.tv_usec * 1e-6) - (distributed.tv_sec + distributed.tv_usec * 1e-6);
+
+    // Every batch reads all of A once; x and y are small next to it
+    double kernelBandwidth = kernelMax > 0 ? (double)sizeof(T) * N * N * nBatches / kernelMax * 1e-9 : 0.0;
+
+    fprintf(stdout, "%2d: [INFO] Kernel: %s %s\n", rank, block == 1 ? "gemv" : "gemm", gemmIsaName(gemmIsa()));
+    fprintf(stdout, "%2d: [INFO] Sys time: %.6f\n", rank, distTime + streamTime);
+    fprintf(stdout, "%2d: [INFO] Dist. time: %.6f\n", rank, distTime);
+    fprintf(stdout, "%2d: [INFO] Strm. time: %.6f\n", rank, streamTime);
+    fprintf(stdout, "%2d: [INFO] Batches: %d, latency min/avg/max: %.6f / %.6f / %.6f\n", rank, nBatches,
+            batchMin, batchSum / nBatches, batchMax);
+    fprintf(stdout, "%2d: [INFO] Products/s: %.2f\n", rank, streamTime > 0 ? opt->vectors / streamTime : 0.0);
+    fprintf(stdout, "%2d: [INFO] Kernel GB/s: %.2f of %.2f STREAM triad (%.1f%%)\n", rank, kernelBandwidth, stream,
+            stream > 0 ? 100.0 * kernelBandwidth / stream : 0.0);
+  }
+
+  if (rank == 0)
+  {
+    A.release();
+    free(X);
+    free(Y);
+    free(counts);
+    free(displs);
+  }
+  else
+  {
+    localA.release();
+  }
+  free(localX);
+  free(localY);
+  free(pieceY);
+  free(xCounts);
+  free(xDispls);
+  free(pieceCounts);
+
+  MPI_Comm_free(&rowComm);
+  MPI_Comm_free(&colComm);
+  MPI_Comm_free(&cartComm);
+}
 
-    // Receive task (tag=1)
-    logger.log(&compTime, "COMP");
-    MPI_Recv(&rowOffset, 1, MPI_INT, 0, 10, MPI_COMM_WORLD, &status);
-    MPI_Recv(&(A[0][0]), rowsPerTask * N, MPI_INT, 0, 11, MPI_COMM_WORLD, &status);
-    MPI_Recv(&(B[0][0]), N, MPI_INT, 0, 12, MPI_COMM_WORLD, &status);
-    logger.log(&mpiRecvTime, "MPI_Recv");
+int main(int argc, char *argv[])
+{
+  int rank;
+  Options opt;
+  Timing t;
 
-    // fprintf(stdout, "%2d: [INFO] Task received (rows %d, N %d)\n", rank, rowsPerTask, N);
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 
-    allocMatrix(&C, rowsPerTask, 1);
+  parseArgs(argc, argv, &opt);
 
-    // Run task
-    matrixMultiply(A, B, rowsPerTask, 1, &C);
+  // Measured before the timeline starts, so it stays out of COMP and TOTAL
+  double stream = streamBandwidth();
 
-    // Send result (tag=2)
+  std::stringstream tl;
+  tl << std::setw(2) << rank << ": [INFO] Timeline: ";
 
-    logger.log(&compTime, "COMP");
-    MPI_Send(&rowOffset, 1, MPI_INT, 0, 20, MPI_COMM_WORLD);
-    MPI_Send(&(C[0][0]), rowsPerTask, MPI_INT, 0, 21, MPI_COMM_WORLD);
-    logger.log(&mpiSendTime, "MPI_Send");
+  // start profiling
+  Logger logger(&tl);
 
-    // fprintf(stdout, "%2d: [INFO] Result sent\n", rank);
+  switch (opt.dataType)
+  {
+  case DATA_FLOAT:
+    run<float>(&opt, stream, &logger, &t);
+    break;
+  case DATA_DOUBLE:
+    run<double>(&opt, stream, &logger, &t);
+    break;
+  default:
+    run<int>(&opt, stream, &logger, &t);
+    break;
   }
 
   MPI_Finalize();
 
-  double mpiTime = mpiSendTime + mpiRecvTime + mpiSendRecvTime;
-  double totalTime = compTime + mpiTime;
-
-  std::cout << std::setw(2) << rank << ": [INFO] Send  time: " << std::setprecision(6) << mpiSendTime << std::endl;
-  std::cout << std::setw(2) << rank << ": [INFO] Recv  time: " << std::setprecision(6) << mpiRecvTime << std::endl;
-  std::cout << std::setw(2) << rank << ": [INFO] SndR. time: " << std::setprecision(6) << mpiSendRecvTime << std::endl;
+  double mpiTime = t.mpiSendTime + t.mpiRecvTime + t.mpiSendRecvTime + t.mpiBcastTime + t.mpiGathervTime +
+                   t.mpiScattervTime + t.mpiReduceScatterTime + t.mpiCartTime + t.mpiTypeTime;
+  double totalTime = t.compTime + mpiTime;
+
+  std::cout << std::setw(2) << rank << ": [INFO] Send  time: " << std::setprecision(6) << t.mpiSendTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Recv  time: " << std::setprecision(6) << t.mpiRecvTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] SndR. time: " << std::setprecision(6) << t.mpiSendRecvTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Bcst. time: " << std::setprecision(6) << t.mpiBcastTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Gthv. time: " << std::setprecision(6) << t.mpiGathervTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Sctv. time: " << std::setprecision(6) << t.mpiScattervTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] RdSc. time: " << std::setprecision(6) << t.mpiReduceScatterTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Cart. time: " << std::setprecision(6) << t.mpiCartTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Type. time: " << std::setprecision(6) << t.mpiTypeTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Kern. time: " << std::setprecision(6) << t.kernelTime << std::endl;
   std::cout << std::setw(2) << rank << ": [INFO] COMM. TIME: " << std::setprecision(6) << mpiTime << std::endl;
-  std::cout << std::setw(2) << rank << ": [INFO] COMP. TIME: " << std::setprecision(6) << compTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] COMP. TIME: " << std::setprecision(6) << t.compTime << std::endl;
   std::cout << std::setw(2) << rank << ": [INFO] TOTAL TIME: " << std::setprecision(6) << totalTime << std::endl;
   std::cout << tl.str() << std::endl;
 
@@ -0,0 +1,732 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <mpi.h>
+#include <sys/time.h>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include "logger.h"
+
+// Longest Matrix Market data line read past the end of a rank's byte range
+#define MM_LINE_MAX 1024
+
+// Most bytes read by one MPI-IO call, its count is an int
+#define MM_READ_MAX ((size_t)INT_MAX)
+
+struct Options
+{
+  const char *path;
+  int iterations;
+};
+
+struct Timing
+{
+  double compTime = 0.0;
+  double mpiFileTime = 0.0;
+  double mpiAllreduceTime = 0.0;
+  double mpiAlltoallTime = 0.0;
+  double mpiHaloTime = 0.0;
+
+  // Time spent inside the local SpMV kernel only
+  double kernelTime = 0.0;
+};
+
+// Header of a coordinate Matrix Market file
+struct MatrixMarket
+{
+  long rows;
+  long cols;
+  long entries;
+  int pattern;
+  int symmetric;
+  int skew;
+  long dataOffset;
+};
+
+// One stored nonzero while the matrix is read and redistributed
+struct Entry
+{
+  int row;
+  int col;
+  double val;
+};
+
+// Rows [rowStart, rowStart + rows) in CSR, columns renumbered: local x
+// entries first (col - rowStart), then the halo entries in plan order
+struct LocalCsr
+{
+  int rowStart;
+  int rows;
+  std::vector<int> rowPtr;
+  std::vector<int> colIdx;
+  std::vector<double> vals;
+};
+
+// x entries exchanged before every product, computed once from the sparsity
+// pattern. Entries from (to) each neighbour are contiguous in recvBuf
+// (sendBuf), and the persistent requests are restarted every iteration
+struct HaloPlan
+{
+  std::vector<int> recvRanks, recvCounts, recvOffsets;
+  std::vector<int> sendRanks, sendCounts, sendOffsets;
+  std::vector<int> sendIdx;
+  std::vector<double> sendBuf;
+  std::vector<MPI_Request> reqs;
+};
+
+void usage(char *prog)
+{
+  fprintf(stderr, "Usage: %s <matrix.mtx> [-i iterations]\n", prog);
+  fprintf(stderr, "  -i  products y = A * x timed after one warm-up product (default: 100)\n");
+}
+
+void parseArgs(int argc, char *argv[], Options *opt)
+{
+  int c;
+
+  opt->iterations = 100;
+
+  while ((c = getopt(argc, argv, "i:")) != -1)
+  {
+    switch (c)
+    {
+    case 'i':
+      opt->iterations = atoi(optarg);
+      if (opt->iterations < 1)
+      {
+        fprintf(stderr, "[ERROR] Iteration count must be positive, found '%s'\n", optarg);
+        exit(1);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  // Check for the right number of arguments
+  if (argc - optind != 1)
+  {
+    fprintf(stderr, "[ERROR] Must be run with exactly 1 argument, found %d!\n", argc - optind);
+    usage(argv[0]);
+    exit(1);
+  }
+
+  opt->path = argv[optind];
+  if (*opt->path == 0)
+  {
+    fprintf(stderr, "[ERROR] Argument is an empty string\n");
+    exit(1);
+  }
+}
+
+// Parse banner and size line (rank 0 only). Returns 0 on success
+int readHeader(const char *path, MatrixMarket *mm)
+{
+  char line[MM_LINE_MAX];
+  char object[64], format[64], field[64], symmetry[64];
+  FILE *fp = fopen(path, "r");
+
+  if (!fp)
+  {
+    fprintf(stderr, "[ERROR] Cannot open '%s'\n", path);
+    return -1;
+  }
+
+  if (!fgets(line, sizeof(line), fp) ||
+      sscanf(line, "%%%%MatrixMarket %63s %63s %63s %63s", object, format, field, symmetry) != 4)
+  {
+    fprintf(stderr, "[ERROR] '%s' has no Matrix Market banner\n", path);
+    fclose(fp);
+    return -1;
+  }
+
+  if (strcmp(object, "matrix") != 0 || strcmp(format, "coordinate") != 0)
+  {
+    fprintf(stderr, "[ERROR] Only coordinate matrices are supported, found '%s %s'\n", object, format);
+    fclose(fp);
+    return -1;
+  }
+  if (strcmp(field, "real") != 0 && strcmp(field, "integer") != 0 && strcmp(field, "pattern") != 0)
+  {
+    fprintf(stderr, "[ERROR] Unsupported field '%s'\n", field);
+    fclose(fp);
+    return -1;
+  }
+
+  mm->pattern = strcmp(field, "pattern") == 0;
+  mm->symmetric = strcmp(symmetry, "symmetric") == 0 || strcmp(symmetry, "hermitian") == 0;
+  mm->skew = strcmp(symmetry, "skew-symmetric") == 0;
+  if (!mm->symmetric && !mm->skew && strcmp(symmetry, "general") != 0)
+  {
+    fprintf(stderr, "[ERROR] Unsupported symmetry '%s'\n", symmetry);
+    fclose(fp);
+    return -1;
+  }
+
+  // Comments, then the size line
+  do
+  {
+    if (!fgets(line, sizeof(line), fp))
+    {
+      fprintf(stderr, "[ERROR] '%s' has no size line\n", path);
+      fclose(fp);
+      return -1;
+    }
+  } while (line[0] == '%' || line[0] == '\n');
+
+  if (sscanf(line, "%ld %ld %ld", &mm->rows, &mm->cols, &mm->entries) != 3)
+  {
+    fprintf(stderr, "[ERROR] Bad size line '%s'\n", line);
+    fclose(fp);
+    return -1;
+  }
+
+  mm->dataOffset = ftell(fp);
+  fclose(fp);
+  return 0;
+}
+
+// Every rank reads an equal byte range of the data lines with MPI-IO and
+// parses the lines starting inside it. Symmetric entries are mirrored here
+void readEntries(const char *path, const MatrixMarket *mm, std::vector<Entry> *entries, Logger *logger, Timing *t)
+{
+  int rank, size;
+  MPI_File fh;
+  MPI_Offset fileSize;
+  MPI_Status status;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  if (MPI_File_open(MPI_COMM_WORLD, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+  {
+    fprintf(stderr, "[ERROR] MPI_File_open failed for '%s'\n", path);
+    MPI_Abort(MPI_COMM_WORLD, 2);
+  }
+  MPI_File_get_size(fh, &fileSize);
+
+  MPI_Offset length = fileSize - mm->dataOffset;
+  MPI_Offset start = mm->dataOffset + length * rank / size;
+  MPI_Offset end = mm->dataOffset + length * (rank + 1) / size;
+
+  // One byte before the range tells whether a line starts at its first
+  // byte, MM_LINE_MAX bytes after it complete the last line
+  MPI_Offset readStart = start > mm->dataOffset ? start - 1 : start;
+  MPI_Offset readEnd = end + MM_LINE_MAX < fileSize ? end + MM_LINE_MAX : fileSize;
+  size_t count = (size_t)(readEnd - readStart);
+
+  char *buf = (char *)malloc(count + 1);
+  if (!buf)
+  {
+    fprintf(stderr, "[ERROR] Read buffer alloc failed!\n");
+    MPI_Abort(MPI_COMM_WORLD, 3);
+  }
+  logger->log(&t->compTime, "COMP");
+
+  // MPI counts are int, so a range of 2 GiB or more is read in pieces. Every
+  // rank takes part in as many collective reads as the largest range needs
+  long pieces = (long)((count + MM_READ_MAX - 1) / MM_READ_MAX), maxPieces;
+  MPI_Allreduce(&pieces, &maxPieces, 1, MPI_LONG, MPI_MAX, MPI_COMM_WORLD);
+
+  for (long k = 0; k < maxPieces; k++)
+  {
+    size_t offset = (size_t)k * MM_READ_MAX;
+    size_t left = offset < count ? count - offset : 0;
+    int n = (int)(left < MM_READ_MAX ? left : MM_READ_MAX);
+    MPI_File_read_at_all(fh, readStart + (MPI_Offset)offset, buf + (offset < count ? offset : count), n, MPI_CHAR,
+                         &status);
+  }
+  MPI_File_close(&fh);
+  logger->log(&t->mpiFileTime, "MPI_File_");
+
+  buf[count] = 0;
+
+  char *p = buf + (start - readStart);
+  char *stop = buf + (end - readStart);
+
+  // Skip the tail of a line that began in the previous rank's range
+  if (start > mm->dataOffset && p[-1] != '\n')
+  {
+    while (p < stop && *p != '\n')
+    {
+      p++;
+    }
+    p++;
+  }
+
+  // Lines parsed, i.e. entries as the header counts them (before mirroring)
+  long parsed = 0;
+
+  while (p < stop)
+  {
+    // strtol would skip a newline too and take the entry of the next line,
+    // which may start in the next rank's range
+    char *q = p;
+    while (*q == ' ' || *q == '\t')
+    {
+      q++;
+    }
+    if (*q == '\n' || *q == '\r' || *q == 0)
+    {
+      // Blank line
+      p = strchr(q, '\n');
+      if (!p)
+      {
+        break;
+      }
+      p++;
+      continue;
+    }
+
+    char *next;
+    long i = strtol(q, &next, 10);
+    if (next == q)
+    {
+      fprintf(stderr, "[ERROR] Bad entry line '%.*s'\n", (int)strcspn(q, "\n"), q);
+      MPI_Abort(MPI_COMM_WORLD, 2);
+    }
+    p = next;
+    long j = strtol(p, &p, 10);
+    double v = mm->pattern ? 1.0 : strtod(p, &p);
+
+    Entry e = {(int)i - 1, (int)j - 1, v};
+    entries->push_back(e);
+    if ((mm->symmetric || mm->skew) && i != j)
+    {
+      Entry m = {(int)j - 1, (int)i - 1, mm->skew ? -v : v};
+      entries->push_back(m);
+    }
+    parsed++;
+
+    while (*p && *p != '\n')
+    {
+      p++;
+    }
+    if (*p)
+    {
+      p++;
+    }
+  }
+
+  free(buf);
+  logger->log(&t->compTime, "COMP");
+
+  // A line read by two ranks or by none would silently change the matrix
+  MPI_Allreduce(MPI_IN_PLACE, &parsed, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+  logger->log(&t->mpiAllreduceTime, "MPI_Allreduce");
+
+  if (parsed != mm->entries)
+  {
+    if (rank == 0)
+    {
+      fprintf(stderr, "[ERROR] Read %ld entries, the header says %ld\n", parsed, mm->entries);
+    }
+    MPI_Abort(MPI_COMM_WORLD, 2);
+  }
+}
+
+// Split rows so every rank owns about the same number of nonzeros. rowStart
+// has size + 1 entries, rank r owns rows [rowStart[r], rowStart[r + 1])
+void partitionRows(const std::vector<Entry> &entries, long rows, std::vector<int> *rowStart,
+                   long *nnz, Logger *logger, Timing *t)
+{
+  int size;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  std::vector<int> rowNnz(rows, 0);
+  for (size_t e = 0; e < entries.size(); e++)
+  {
+    rowNnz[entries[e].row]++;
+  }
+  logger->log(&t->compTime, "COMP");
+
+  MPI_Allreduce(MPI_IN_PLACE, rowNnz.data(), (int)rows, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  logger->log(&t->mpiAllreduceTime, "MPI_Allreduce");
+
+  std::vector<long> prefix(rows + 1, 0);
+  for (long i = 0; i < rows; i++)
+  {
+    prefix[i + 1] = prefix[i] + rowNnz[i];
+  }
+  *nnz = prefix[rows];
+
+  rowStart->resize(size + 1);
+  for (int r = 0; r <= size; r++)
+  {
+    long target = *nnz * r / size;
+    (*rowStart)[r] = (int)(std::lower_bound(prefix.begin(), prefix.end(), target) - prefix.begin());
+  }
+  (*rowStart)[0] = 0;
+  (*rowStart)[size] = (int)rows;
+}
+
+// Rank owning row (and x entry) i
+int ownerOf(const std::vector<int> &rowStart, int i)
+{
+  return (int)(std::upper_bound(rowStart.begin(), rowStart.end(), i) - rowStart.begin()) - 1;
+}
+
+// Send every entry to the owner of its row
+void redistribute(std::vector<Entry> *entries, const std::vector<int> &rowStart, Logger *logger, Timing *t)
+{
+  int size;
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  std::vector<int> sendCounts(size, 0), recvCounts(size), sendDispls(size), recvDispls(size);
+  for (size_t e = 0; e < entries->size(); e++)
+  {
+    sendCounts[ownerOf(rowStart, (*entries)[e].row)]++;
+  }
+
+  sendDispls[0] = 0;
+  for (int r = 1; r < size; r++)
+  {
+    sendDispls[r] = sendDispls[r - 1] + sendCounts[r - 1];
+  }
+
+  std::vector<Entry> sendBuf(entries->size());
+  std::vector<int> fill(sendDispls);
+  for (size_t e = 0; e < entries->size(); e++)
+  {
+    sendBuf[fill[ownerOf(rowStart, (*entries)[e].row)]++] = (*entries)[e];
+  }
+  logger->log(&t->compTime, "COMP");
+
+  MPI_Datatype entryType;
+  int blockLengths[2] = {2, 1};
+  MPI_Aint offsets[2] = {offsetof(Entry, row), offsetof(Entry, val)};
+  MPI_Datatype types[2] = {MPI_INT, MPI_DOUBLE};
+  MPI_Type_create_struct(2, blockLengths, offsets, types, &entryType);
+  MPI_Type_create_resized(entryType, 0, sizeof(Entry), &entryType);
+  MPI_Type_commit(&entryType);
+
+  MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+
+  recvDispls[0] = 0;
+  for (int r = 1; r < size; r++)
+  {
+    recvDispls[r] = recvDispls[r - 1] + recvCounts[r - 1];
+  }
+  entries->resize(recvDispls[size - 1] + recvCounts[size - 1]);
+
+  MPI_Alltoallv(sendBuf.data(), sendCounts.data(), sendDispls.data(), entryType,
+                entries->data(), recvCounts.data(), recvDispls.data(), entryType, MPI_COMM_WORLD);
+  MPI_Type_free(&entryType);
+  logger->log(&t->mpiAlltoallTime, "MPI_Alltoallv");
+}
+
+// CSR of the owned rows and the halo plan for the columns owned elsewhere
+void buildCsr(const std::vector<Entry> &entries, const std::vector<int> &rowStart, LocalCsr *csr,
+              HaloPlan *plan, Logger *logger, Timing *t)
+{
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  csr->rowStart = rowStart[rank];
+  csr->rows = rowStart[rank + 1] - rowStart[rank];
+  int colEnd = csr->rowStart + csr->rows;
+
+  // Remote columns, sorted, so the entries of each owner are contiguous
+  std::vector<int> halo;
+  for (size_t e = 0; e < entries.size(); e++)
+  {
+    int col = entries[e].col;
+    if (col < csr->rowStart || col >= colEnd)
+    {
+      halo.push_back(col);
+    }
+  }
+  std::sort(halo.begin(), halo.end());
+  halo.erase(std::unique(halo.begin(), halo.end()), halo.end());
+
+  // Counting sort by row, then columns in increasing order within a row
+  csr->rowPtr.assign(csr->rows + 1, 0);
+  for (size_t e = 0; e < entries.size(); e++)
+  {
+    csr->rowPtr[entries[e].row - csr->rowStart + 1]++;
+  }
+  for (int i = 0; i < csr->rows; i++)
+  {
+    csr->rowPtr[i + 1] += csr->rowPtr[i];
+  }
+
+  std::vector<int> fill(csr->rowPtr.begin(), csr->rowPtr.end() - 1);
+  std::vector<std::pair<int, double>> sorted(entries.size());
+  for (size_t e = 0; e < entries.size(); e++)
+  {
+    sorted[fill[entries[e].row - csr->rowStart]++] = std::make_pair(entries[e].col, entries[e].val);
+  }
+  for (int i = 0; i < csr->rows; i++)
+  {
+    std::sort(sorted.begin() + csr->rowPtr[i], sorted.begin() + csr->rowPtr[i + 1]);
+  }
+
+  csr->colIdx.resize(entries.size());
+  csr->vals.resize(entries.size());
+  for (size_t e = 0; e < sorted.size(); e++)
+  {
+    int col = sorted[e].first;
+    if (col >= csr->rowStart && col < colEnd)
+    {
+      csr->colIdx[e] = col - csr->rowStart;
+    }
+    else
+    {
+      csr->colIdx[e] = csr->rows + (int)(std::lower_bound(halo.begin(), halo.end(), col) - halo.begin());
+    }
+    csr->vals[e] = sorted[e].second;
+  }
+
+  // Requests per owner, then tell every owner which of its entries to send
+  std::vector<int> wantCounts(size, 0), giveCounts(size), wantDispls(size), giveDispls(size);
+  for (size_t h = 0; h < halo.size(); h++)
+  {
+    wantCounts[ownerOf(rowStart, halo[h])]++;
+  }
+  logger->log(&t->compTime, "COMP");
+
+  MPI_Alltoall(wantCounts.data(), 1, MPI_INT, giveCounts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+
+  wantDispls[0] = giveDispls[0] = 0;
+  for (int r = 1; r < size; r++)
+  {
+    wantDispls[r] = wantDispls[r - 1] + wantCounts[r - 1];
+    giveDispls[r] = giveDispls[r - 1] + giveCounts[r - 1];
+  }
+  plan->sendIdx.resize(giveDispls[size - 1] + giveCounts[size - 1]);
+
+  MPI_Alltoallv(halo.data(), wantCounts.data(), wantDispls.data(), MPI_INT,
+                plan->sendIdx.data(), giveCounts.data(), giveDispls.data(), MPI_INT, MPI_COMM_WORLD);
+  logger->log(&t->mpiAlltoallTime, "MPI_Alltoallv");
+
+  for (size_t s = 0; s < plan->sendIdx.size(); s++)
+  {
+    plan->sendIdx[s] -= csr->rowStart;
+  }
+  plan->sendBuf.resize(plan->sendIdx.size());
+
+  for (int r = 0; r < size; r++)
+  {
+    if (wantCounts[r] > 0)
+    {
+      plan->recvRanks.push_back(r);
+      plan->recvCounts.push_back(wantCounts[r]);
+      plan->recvOffsets.push_back(wantDispls[r]);
+    }
+    if (giveCounts[r] > 0)
+    {
+      plan->sendRanks.push_back(r);
+      plan->sendCounts.push_back(giveCounts[r]);
+      plan->sendOffsets.push_back(giveDispls[r]);
+    }
+  }
+}
+
+// Bind the persistent halo requests to x (local part followed by the halo)
+void initHalo(HaloPlan *plan, std::vector<double> *x, int rows)
+{
+  plan->reqs.resize(plan->recvRanks.size() + plan->sendRanks.size());
+
+  int n = 0;
+  for (size_t r = 0; r < plan->recvRanks.size(); r++)
+  {
+    MPI_Recv_init(x->data() + rows + plan->recvOffsets[r], plan->recvCounts[r], MPI_DOUBLE,
+                  plan->recvRanks[r], 30, MPI_COMM_WORLD, &plan->reqs[n++]);
+  }
+  for (size_t s = 0; s < plan->sendRanks.size(); s++)
+  {
+    MPI_Send_init(plan->sendBuf.data() + plan->sendOffsets[s], plan->sendCounts[s], MPI_DOUBLE,
+                  plan->sendRanks[s], 30, MPI_COMM_WORLD, &plan->reqs[n++]);
+  }
+}
+
+void exchangeHalo(HaloPlan *plan, const std::vector<double> &x)
+{
+  for (size_t s = 0; s < plan->sendIdx.size(); s++)
+  {
+    plan->sendBuf[s] = x[plan->sendIdx[s]];
+  }
+  if (plan->reqs.empty())
+  {
+    return;
+  }
+  MPI_Startall((int)plan->reqs.size(), plan->reqs.data());
+  MPI_Waitall((int)plan->reqs.size(), plan->reqs.data(), MPI_STATUSES_IGNORE);
+}
+
+// y = A * x for the owned rows
+void spmv(const LocalCsr &csr, const double *x, double *y)
+{
+  const int *rowPtr = csr.rowPtr.data();
+  const int *colIdx = csr.colIdx.data();
+  const double *vals = csr.vals.data();
+
+  for (int i = 0; i < csr.rows; i++)
+  {
+    double sum = 0.0;
+    for (int k = rowPtr[i]; k < rowPtr[i + 1]; k++)
+    {
+      sum += vals[k] * x[colIdx[k]];
+    }
+    y[i] = sum;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int rank, size;
+  Options opt;
+  Timing t;
+  MatrixMarket mm;
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+  parseArgs(argc, argv, &opt);
+
+  std::stringstream tl;
+  tl << std::setw(2) << rank << ": [INFO] Timeline: ";
+
+  // start profiling
+  Logger logger(&tl);
+
+  double readStart = MPI_Wtime();
+
+  int ok = 0;
+  if (rank == 0)
+  {
+    ok = readHeader(opt.path, &mm) == 0;
+    if (ok && mm.rows != mm.cols)
+    {
+      fprintf(stderr, "[ERROR] Matrix must be square, found %ld x %ld\n", mm.rows, mm.cols);
+      ok = 0;
+    }
+  }
+  MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (!ok)
+  {
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  MPI_Bcast(&mm, sizeof(mm), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+  std::vector<Entry> entries;
+  readEntries(opt.path, &mm, &entries, &logger, &t);
+
+  double readTime = MPI_Wtime() - readStart;
+  double setupStart = MPI_Wtime();
+
+  std::vector<int> rowStart;
+  long nnz;
+  partitionRows(entries, mm.rows, &rowStart, &nnz, &logger, &t);
+  redistribute(&entries, rowStart, &logger, &t);
+
+  LocalCsr csr;
+  HaloPlan plan;
+  buildCsr(entries, rowStart, &csr, &plan, &logger, &t);
+  entries.clear();
+  entries.shrink_to_fit();
+
+  // x[i] = i % 7 + 1, followed by room for the halo entries
+  int haloSize = 0;
+  for (size_t r = 0; r < plan.recvCounts.size(); r++)
+  {
+    haloSize += plan.recvCounts[r];
+  }
+  std::vector<double> x(csr.rows + haloSize + 1, 0.0);
+  for (int i = 0; i < csr.rows; i++)
+  {
+    x[i] = (csr.rowStart + i) % 7 + 1;
+  }
+  std::vector<double> y(csr.rows > 0 ? csr.rows : 1, 0.0);
+
+  initHalo(&plan, &x, csr.rows);
+  logger.log(&t.compTime, "COMP");
+
+  double setupTime = MPI_Wtime() - setupStart;
+
+  // Warm-up product, not timed
+  exchangeHalo(&plan, x);
+  spmv(csr, x.data(), y.data());
+  MPI_Barrier(MPI_COMM_WORLD);
+  logger.log(&t.compTime, "COMP");
+
+  double runStart = MPI_Wtime();
+  for (int iter = 0; iter < opt.iterations; iter++)
+  {
+    exchangeHalo(&plan, x);
+    logger.log(&t.mpiHaloTime, "MPI_Startall");
+
+    double kernelStart = MPI_Wtime();
+    spmv(csr, x.data(), y.data());
+    t.kernelTime += MPI_Wtime() - kernelStart;
+    logger.log(&t.compTime, "COMP");
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+  double runTime = MPI_Wtime() - runStart;
+  logger.log(&t.compTime, "COMP");
+
+  // Checksum of y and halo volume for the summary
+  double localSum = 0.0, checksum = 0.0;
+  for (int i = 0; i < csr.rows; i++)
+  {
+    localSum += y[i];
+  }
+  long local[2] = {(long)csr.vals.size(), (long)haloSize}, maxLocal[2], totalHalo;
+  double kernelMax;
+  MPI_Reduce(&localSum, &checksum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  MPI_Reduce(local, maxLocal, 2, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&local[1], &totalHalo, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&t.kernelTime, &kernelMax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  logger.log(&t.mpiAllreduceTime, "MPI_Reduce");
+
+  if (rank == 0)
+  {
+    // Minimum traffic of one product: each value and column index, the row
+    // pointers, one read of x and one write of y
+    double bytes = nnz * (sizeof(double) + sizeof(int)) + (mm.rows + size) * sizeof(int) + 2.0 * mm.rows * sizeof(double);
+    double flops = 2.0 * nnz * opt.iterations;
+
+    fprintf(stdout, "%2d: [INFO] Matrix: %s, N: %ld, nnz: %ld, NP: %d\n", rank, opt.path, mm.rows, nnz, size);
+    fprintf(stdout, "%2d: [INFO] nnz per rank: avg %ld, max %ld\n", rank, nnz / size, maxLocal[0]);
+    fprintf(stdout, "%2d: [INFO] Halo entries per product: total %ld, max %ld\n", rank, totalHalo, maxLocal[1]);
+    fprintf(stdout, "%2d: [INFO] Read  time: %.6f\n", rank, readTime);
+    fprintf(stdout, "%2d: [INFO] Setup time: %.6f\n", rank, setupTime);
+    fprintf(stdout, "%2d: [INFO] Sys time: %.6f (%d products)\n", rank, runTime, opt.iterations);
+    fprintf(stdout, "%2d: [INFO] GFLOP/s: %.3f\n", rank, flops / runTime * 1e-9);
+    fprintf(stdout, "%2d: [INFO] GB/s: %.3f (%.2f bytes per nnz)\n", rank, bytes * opt.iterations / runTime * 1e-9,
+            bytes / nnz);
+    fprintf(stdout, "%2d: [INFO] Kernel GB/s: %.3f\n", rank, kernelMax > 0 ? bytes * opt.iterations / kernelMax * 1e-9 : 0.0);
+    fprintf(stdout, "%2d: [INFO] Checksum: %.6e\n", rank, checksum);
+  }
+
+  for (size_t r = 0; r < plan.reqs.size(); r++)
+  {
+    MPI_Request_free(&plan.reqs[r]);
+  }
+
+  MPI_Finalize();
+
+  double mpiTime = t.mpiFileTime + t.mpiAllreduceTime + t.mpiAlltoallTime + t.mpiHaloTime;
+  double totalTime = t.compTime + mpiTime;
+
+  std::cout << std::setw(2) << rank << ": [INFO] File  time: " << std::setprecision(6) << t.mpiFileTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Allr. time: " << std::setprecision(6) << t.mpiAllreduceTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] A2Av. time: " << std::setprecision(6) << t.mpiAlltoallTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Halo  time: " << std::setprecision(6) << t.mpiHaloTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] Kern. time: " << std::setprecision(6) << t.kernelTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] COMM. TIME: " << std::setprecision(6) << mpiTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] COMP. TIME: " << std::setprecision(6) << t.compTime << std::endl;
+  std::cout << std::setw(2) << rank << ": [INFO] TOTAL TIME: " << std::setprecision(6) << totalTime << std::endl;
+  std::cout << tl.str() << std::endl;
+
+  return 0;
+}